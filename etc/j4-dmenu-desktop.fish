@@ -7,10 +7,17 @@ complete -c j4-dmenu-desktop          -l no-exec            -d "Do not execute s
 complete -c j4-dmenu-desktop          -l no-generic         -d "Do not include the generic name of desktop entries"
 complete -c j4-dmenu-desktop -Fr -s t -l term               -d "Sets the terminal emulator used to start terminal apps"
 complete -c j4-dmenu-desktop -x       -l term-mode -a "default xterm alacritty kitty terminator gnome-terminal custom" -d "Set terminal emulator execution strategy"
+complete -c j4-dmenu-desktop          -l memory-term-scripts -d "Keep temporary scripts for terminal emulator in memory"
 complete -c j4-dmenu-desktop -Fr      -l usage-log          -d "Set usage log"
 complete -c j4-dmenu-desktop          -l prune-bad-usage-log-entries -d "Remove bad history entries"
+complete -c j4-dmenu-desktop -x       -l usage-log-capacity -d "Limit the number of usage log entries"
+complete -c j4-dmenu-desktop          -l frecency           -d "Sort history by frecency"
 complete -c j4-dmenu-desktop     -s x -l use-xdg-de         -d "Enables reading \$XDG_CURRENT_DESKTOP to determine the desktop environment"
 complete -c j4-dmenu-desktop -Fr      -l wait-on            -d "Enable daemon mode"
+complete -c j4-dmenu-desktop -x       -l wait-on-debounce   -d "Delay applying changes of desktop files in daemon mode"
+complete -c j4-dmenu-desktop -x       -l poll-interval      -d "Set interval of polling network filesystems in daemon mode"
+complete -c j4-dmenu-desktop -Fr      -l poll-path          -d "Poll search path directories in path"
+complete -c j4-dmenu-desktop          -l menu-snapshot      -d "Share the menu of a daemon through a snapshot"
 complete -c j4-dmenu-desktop -Fr      -l wrapper            -d "A wrapper binary"
 complete -c j4-dmenu-desktop     -s I -l i3-ipc             -d "Execute desktop entries through i3 IPC"
 complete -c j4-dmenu-desktop          -l skip-i3-exec-check -d "Disable the check for '--wrapper \"i3 exec\"'"
@@ -19,5 +26,11 @@ complete -c j4-dmenu-desktop     -s v                       -d "Be more verbose,
 complete -c j4-dmenu-desktop -x       -l log-level -a "ERROR WARNING INFO DEBUG" -d "Set loglevel"
 complete -c j4-dmenu-desktop -Fr      -l log-file           -d "Specify a log file"
 complete -c j4-dmenu-desktop -x       -l log-file-level -a "ERROR WARNING INFO DEBUG" -d "Set file loglevel"
+complete -c j4-dmenu-desktop -x       -l flight-recorder    -d "Write log records to the log file only on errors"
+complete -c j4-dmenu-desktop          -l log-file-async     -d "Write the log file in a separate thread"
+complete -c j4-dmenu-desktop -x       -l profile -a "text json" -d "Print durations of phases of j4-dmenu-desktop"
+complete -c j4-dmenu-desktop -Fr      -l trace-file         -d "Write a trace of j4-dmenu-desktop to file"
+complete -c j4-dmenu-desktop -Fr      -l metrics-file       -d "Save latency metrics of the daemon to file"
+complete -c j4-dmenu-desktop          -l stats              -d "Print memory usage of j4-dmenu-desktop after startup"
 complete -c j4-dmenu-desktop     -s h -l help               -d "Display help message"
 complete -c j4-dmenu-desktop          -l version            -d "Display program version"
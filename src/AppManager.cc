@@ -21,8 +21,16 @@
 
 #include <algorithm>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unordered_set>
 
-using std::in_place_t;
+#include "Probes.hh"
+#include "Profiler.hh"
+#include "Tracer.hh"
+
+static bool same_timestamp(const timespec &a, const timespec &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
 
 std::string get_desktop_id(std::string filename) {
     std::string result(std::move(filename));
@@ -44,6 +52,9 @@ std::string get_desktop_id(const std::string &filename, std::string_view base) {
 Desktop_file_rank::Desktop_file_rank(string b, std::vector<string> f)
     : base_path(std::move(b)), files(std::move(f)) {}
 
+AppManager::known_file::known_file(int rank, time_t read_at)
+    : rank(rank), read_at(read_at) {}
+
 Resolved_application::Resolved_application(const Application *app,
                                            bool is_generic)
     : app(app), is_generic(is_generic) {}
@@ -82,6 +93,7 @@ AppManager::AppManager(Desktop_file_list files, stringlist_t desktopenvs,
         SPDLOG_ERROR("Rank overflow in AppManager ctor!");
         exit(EXIT_FAILURE);
     }
+    time_t read_at = time(NULL);
     for (int rank = 0; rank < (int)files.size(); ++rank) {
         auto &rank_files = files[rank].files;
         auto &rank_base_path = files[rank].base_path;
@@ -89,25 +101,28 @@ AppManager::AppManager(Desktop_file_list files, stringlist_t desktopenvs,
         SPDLOG_DEBUG("AppManager: Processing rank -> {} <- (base: {})", rank,
                      rank_base_path);
 
-        for (const string &filename : rank_files) {
+        for (string &rank_file : rank_files) {
+            auto &[filename, known] =
+                *this->known_files
+                     .try_emplace(std::move(rank_file), rank, read_at)
+                     .first;
             string desktop_file_ID = get_desktop_id(filename, rank_base_path);
 
             SPDLOG_DEBUG("AppManager:   Handling file '{}' ID: {}", filename,
                          desktop_file_ID);
 
-            try {
-                auto try_add = this->applications.try_emplace(
-                    desktop_file_ID, rank, in_place_t{}, filename.c_str(),
-                    this->liner, this->suffixes, this->desktopenvs);
-
-                // Handle desktop file ID collision.
-                if (!try_add.second) {
-                    SPDLOG_DEBUG(
-                        "AppManager:     Collision detected, skipping!");
-                    continue;
-                }
+            // Handle desktop file ID collision.
+            if (this->applications.count(desktop_file_ID) != 0) {
+                SPDLOG_DEBUG("AppManager:     Collision detected, skipping!");
+                continue;
+            }
 
-                Managed_application &newly_added = try_add.first->second;
+            try {
+                Managed_application &newly_added =
+                    this->applications
+                        .try_emplace(desktop_file_ID, rank,
+                                     read_desktop_file(filename, known))
+                        .first->second;
 
                 // Add the names.
                 auto add_result = this->name_app_mapping.try_emplace(
@@ -130,11 +145,7 @@ AppManager::AppManager(Desktop_file_list files, stringlist_t desktopenvs,
                 SPDLOG_DEBUG("AppManager:     Desktop file is disabled: {}",
                              e.what());
                 // Add an empty Application that only occupies desktop ID + rank
-                auto try_add =
-                    this->applications.try_emplace(desktop_file_ID, rank);
-                if (!try_add.second)
-                    SPDLOG_DEBUG(
-                        "AppManager:     Collision detected, skipping!");
+                this->applications.try_emplace(desktop_file_ID, rank);
                 continue;
             } catch (invalid_error &e) {
                 SPDLOG_WARN("Couldn't open file '{}': {}", filename, e.what());
@@ -144,13 +155,80 @@ AppManager::AppManager(Desktop_file_list files, stringlist_t desktopenvs,
     }
 }
 
+Application AppManager::read_desktop_file(const string &filename,
+                                          known_file &known) {
+    release_target(known);
+
+    struct stat st;
+    // Application ctor reports the error.
+    if (stat(filename.c_str(), &st) == -1) {
+        J4DD_PROBE1(parse_invalid, filename.c_str());
+        Tracer::Span span("parse", filename);
+        Profiler::ParseTimer timer;
+        return Application(filename.c_str(), this->liner, this->suffixes,
+                           this->desktopenvs);
+    }
+
+    file_identity identity(st.st_dev, st.st_ino);
+    auto [iter, inserted] = this->parsed_files.try_emplace(identity);
+    parsed_file &parsed = iter->second;
+    if (inserted || !same_timestamp(parsed.mtime, st.st_mtim) ||
+        !same_timestamp(parsed.ctime, st.st_ctim)) {
+        J4DD_PROBE1(parse_start, filename.c_str());
+        try {
+            Tracer::Span span("parse", filename);
+            Profiler::ParseTimer timer;
+            parsed.app.emplace(filename.c_str(), this->liner, this->suffixes,
+                               this->desktopenvs);
+            J4DD_PROBE1(parse_end, filename.c_str());
+        } catch (disabled_error &e) {
+            J4DD_PROBE1(parse_disabled, filename.c_str());
+            parsed.disabled_reason = e.what();
+        } catch (invalid_error &e) {
+            J4DD_PROBE1(parse_invalid, filename.c_str());
+            if (parsed.references == 0)
+                this->parsed_files.erase(iter);
+            throw;
+        }
+        // The timestamps are updated only after successful parsing, a stale
+        // entry will be parsed again.
+        parsed.mtime = st.st_mtim;
+        parsed.ctime = st.st_ctim;
+    } else
+        SPDLOG_DEBUG("AppManager:     File has already been parsed.");
+
+    ++parsed.references;
+    known.target = identity;
+    if (!parsed.app)
+        throw disabled_error(parsed.disabled_reason);
+    Application result = *parsed.app;
+    result.location = filename;
+    return result;
+}
+
+void AppManager::release_target(known_file &known) {
+    if (!known.target)
+        return;
+    auto iter = this->parsed_files.find(*known.target);
+    known.target.reset();
+    if (iter != this->parsed_files.end() && --iter->second.references == 0)
+        this->parsed_files.erase(iter);
+}
+
 void AppManager::remove(const string &filename, const string &base_path) {
+    Tracer::Span span("AppManager::remove", filename);
+    J4DD_PROBE1(app_remove, filename.c_str());
     // Desktop file ID must be relative to $XDG_DATA_DIRS. We need the base
     // path to determine it. Another solution would be to accept a relative
     // path as the filename.
     string ID = get_desktop_id(filename, base_path);
     SPDLOG_INFO("AppManager: Removing file '{}' (ID: {}, base path: {})",
                 filename, ID, base_path);
+    auto known = this->known_files.find(filename);
+    if (known != this->known_files.end()) {
+        release_target(known->second);
+        this->known_files.erase(known);
+    }
     auto app_iter = this->applications.find(ID);
     if (app_iter == this->applications.end()) {
         SPDLOG_INFO("Removal of desktop file '{}' has been requested (desktop "
@@ -171,11 +249,18 @@ void AppManager::remove(const string &filename, const string &base_path) {
 
 void AppManager::add(const string &filename, const string &base_path,
                      int rank) {
+    Tracer::Span span("AppManager::add", filename);
+    J4DD_PROBE2(app_add, filename.c_str(), rank);
     string ID = get_desktop_id(filename, base_path);
 
     SPDLOG_INFO(
         "AppManager: Adding file '{}' (ID: {}, base path: {}, rank: {})",
         filename, ID, base_path, rank);
+    known_file &known =
+        this->known_files.try_emplace(filename, rank, 0).first->second;
+    release_target(known);
+    known.rank = rank;
+    known.read_at = time(NULL);
 
     // If Application ctor throws, AppManager's state must remain
     // consistent.
@@ -205,8 +290,7 @@ void AppManager::add(const string &filename, const string &base_path,
         // later. We first try to construct Application in a std::optional.
         std::optional<Application> new_app;
         try {
-            new_app.emplace(filename.c_str(), this->liner, this->suffixes,
-                            this->desktopenvs);
+            new_app.emplace(read_desktop_file(filename, known));
         } catch (disabled_error &e) {
             SPDLOG_DEBUG("AppManager:     App is disabled: {}", e.what());
             is_disabled = true;
@@ -235,9 +319,8 @@ void AppManager::add(const string &filename, const string &base_path,
         Managed_application *app_ptr;
         try {
             app_ptr = &this->applications
-                           .try_emplace(ID, rank, in_place_t{},
-                                        filename.c_str(), this->liner,
-                                        this->suffixes, this->desktopenvs)
+                           .try_emplace(ID, rank,
+                                        read_desktop_file(filename, known))
                            .first->second;
         } catch (disabled_error &e) {
             SPDLOG_DEBUG("AppManager:     App is disabled: {}", e.what());
@@ -259,6 +342,37 @@ void AppManager::add(const string &filename, const string &base_path,
     }
 }
 
+void AppManager::reconcile(const Desktop_file_rank &files, int rank) {
+    SPDLOG_INFO("AppManager: Reconciling rank {} (base path: {})", rank,
+                files.base_path);
+
+    std::unordered_set<string_view> present(files.files.begin(),
+                                            files.files.end());
+    std::vector<string> removed;
+    for (const auto &[filename, known] : this->known_files) {
+        if (known.rank == rank && present.count(filename) == 0)
+            removed.push_back(filename);
+    }
+    for (const string &filename : removed)
+        remove(filename, files.base_path);
+
+    for (const string &filename : files.files) {
+        auto known = this->known_files.find(filename);
+        if (known != this->known_files.end() && known->second.rank == rank) {
+            // ctime is checked too, because the file could have been
+            // replaced by an older one. Timestamps have a granularity of
+            // seconds, so files changed in the second in which they have been
+            // read are read again.
+            struct stat st;
+            if (stat(filename.c_str(), &st) == 0 &&
+                st.st_mtime < known->second.read_at &&
+                st.st_ctime < known->second.read_at)
+                continue;
+        }
+        add(filename, files.base_path, rank);
+    }
+}
+
 const AppManager::name_app_mapping_type &
 AppManager::view_name_app_mapping() const {
     return this->name_app_mapping;
@@ -268,6 +382,23 @@ AppManager::applications_type::size_type AppManager::count() const {
     return this->applications.size();
 }
 
+std::size_t AppManager::owned_string_bytes() const {
+    using MemoryStats::string_heap_bytes;
+
+    std::size_t result = 0;
+    for (const auto &[id, managed] : this->applications) {
+        result += string_heap_bytes(id);
+        if (!managed.app)
+            continue;
+        const Application &app = *managed.app;
+        result += string_heap_bytes(app.name) +
+                  string_heap_bytes(app.generic_name) +
+                  string_heap_bytes(app.exec) + string_heap_bytes(app.path) +
+                  string_heap_bytes(app.location) + string_heap_bytes(app.id);
+    }
+    return result;
+}
+
 // This function should be used only for debugging.
 void AppManager::check_inner_state() const {
     // The lifetimes in this class are kinda funky because the lifetime
@@ -26,10 +26,13 @@
 #include <algorithm> // IWYU pragma: keep
 #include <functional>
 #include <limits>
+#include <map>
 #include <optional>
 #include <stdlib.h>
 #include <string>
 #include <string_view>
+#include <sys/types.h>
+#include <time.h>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -37,6 +40,7 @@
 #include "Application.hh"
 #include "LineReader.hh"
 #include "LocaleSuffixes.hh"
+#include "MemoryStats.hh"
 #include "Utilities.hh"
 
 using std::string;
@@ -87,12 +91,20 @@ using Desktop_file_list = std::vector<Desktop_file_rank>;
 
 class AppManager
 {
-    using applications_type =
-        std::unordered_map<string /*desktop ID*/, Managed_application>;
+    using applications_type = std::unordered_map<
+        string /*desktop ID*/, Managed_application, std::hash<string>,
+        std::equal_to<string>,
+        MemoryStats::counting_allocator<
+            std::pair<const string, Managed_application>,
+            MemoryStats::subsystem::applications>>;
 
 public:
-    using name_app_mapping_type =
-        std::unordered_map<string_view /*(Generic)Name*/, Resolved_application>;
+    using name_app_mapping_type = std::unordered_map<
+        string_view /*(Generic)Name*/, Resolved_application,
+        std::hash<string_view>, std::equal_to<string_view>,
+        MemoryStats::counting_allocator<
+            std::pair<const string_view, Resolved_application>,
+            MemoryStats::subsystem::name_app_mapping>>;
 
     AppManager(const AppManager &) = delete;
     AppManager(AppManager &&) = delete;
@@ -106,8 +118,17 @@ public:
     // This function accepts path to the desktop file relative to $XDG_DATA_DIRS
     // and its rank within $XDG_DATA_DIRS
     void add(const string &filename, const string &base_path, int rank);
+    // Bring a rank up to date with the desktop files it currently contains.
+    // This is used when some changes of the rank could have been missed.
+    // Files which weren't known or which have been changed since AppManager
+    // has read them are add()ed, known files of the rank which are missing
+    // in files are remove()d.
+    void reconcile(const Desktop_file_rank &files, int rank);
     applications_type::size_type count() const;
     const name_app_mapping_type &view_name_app_mapping() const;
+    // Heap bytes owned by desktop IDs and by strings of applications. This is
+    // used by MemoryStats.
+    std::size_t owned_string_bytes() const;
 
     // This function should be used only for debugging.
     void check_inner_state() const;
@@ -263,6 +284,51 @@ private:
     // Map used for lookup and name listing.
     name_app_mapping_type name_app_mapping;
 
+    // Device and inode of the file a desktop file path resolves to.
+    using file_identity = std::pair<dev_t, ino_t>;
+
+    struct known_file
+    {
+        int rank;
+        // Time when AppManager has read the file.
+        time_t read_at;
+        // Entry of parsed_files used by the file. It is unset if the file
+        // hasn't been parsed (because of an ID collision or an error).
+        std::optional<file_identity> target;
+
+        known_file(int rank, time_t read_at);
+    };
+
+    // All desktop files which have been read, including disabled, invalid
+    // and colliding ones. This is needed by reconcile().
+    std::unordered_map<string /*filename*/, known_file> known_files;
+
+    struct parsed_file
+    {
+        // These are used to detect modifications of the file.
+        timespec mtime;
+        timespec ctime;
+        // This is unset if the desktop file is disabled.
+        std::optional<Application> app;
+        // what() of disabled_error if the desktop file is disabled.
+        string disabled_reason;
+        // Number of known_files whose target this is.
+        int references = 0;
+    };
+
+    // Desktop files reachable through several paths (symlinks) are parsed only
+    // once, the other paths get a copy.
+    std::map<file_identity, parsed_file> parsed_files;
+
+    // Construct Application for filename or copy it from parsed_files if
+    // the file has already been parsed. This throws the same exceptions as
+    // Application ctor. known is the known_files entry of filename, its target
+    // is updated.
+    Application read_desktop_file(const string &filename, known_file &known);
+    // Unset target of a known file, the entry in parsed_files is removed when
+    // no known file uses it.
+    void release_target(known_file &known);
+
     // Things needed to construct Application:
     LineReader liner;
     LocaleSuffixes suffixes;
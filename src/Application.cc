@@ -36,6 +36,12 @@ bool Application::operator==(const Application &other) const {
            id == other.id;
 }
 
+const ExecTemplate &Application::get_exec_template() const {
+    if (!this->exec_template)
+        this->exec_template.emplace(*this);
+    return *this->exec_template;
+}
+
 Application::Application(const char *path, LineReader &liner,
                          const LocaleSuffixes &locale_suffixes,
                          const stringlist_t &desktopenvs) {
@@ -139,6 +145,13 @@ Application::Application(const char *path, LineReader &liner,
             "Invalid desktop file! 'Name' key is missing or empty.");
 }
 
+Application::Application(std::string name, std::string generic_name,
+                         std::string exec, std::string path,
+                         std::string location, bool terminal)
+    : name(std::move(name)), generic_name(std::move(generic_name)),
+      exec(std::move(exec)), path(std::move(path)),
+      location(std::move(location)), terminal(terminal) {}
+
 char Application::convert(char escape) {
     switch (escape) {
     case 's':
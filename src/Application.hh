@@ -18,9 +18,11 @@
 #ifndef APPLICATION_DEF
 #define APPLICATION_DEF
 
+#include <optional>
 #include <stdexcept>
 #include <string>
 
+#include "FieldCodes.hh"
 #include "LocaleSuffixes.hh"
 #include "Utilities.hh"
 
@@ -72,15 +74,29 @@ public:
 
     bool operator==(const Application &other) const;
 
+    // Exec is parsed on first use and the result is cached. exec must not be
+    // modified afterwards.
+    const ExecTemplate &get_exec_template() const;
+
+    // Unescape value of a string key. key is used in error messages.
+    static std::string expand(const char *key, const char *value);
+    // Unescape and split value of a string list key.
+    static stringlist_t expandlist(const char *key, const char *value);
+
     // If desktopenvs is {}, notShowIn and onlyShowIn will be ignored.
     Application(const char *path, LineReader &liner,
                 const LocaleSuffixes &locale_suffixes,
                 const stringlist_t &desktopenvs);
 
+    // This constructs an application which has already been parsed elsewhere.
+    // It is used to reconstruct applications stored in MenuSnapshot.
+    Application(std::string name, std::string generic_name, std::string exec,
+                std::string path, std::string location, bool terminal);
+
 private:
+    mutable std::optional<ExecTemplate> exec_template;
+
     static char convert(char escape);
-    std::string expand(const char *key, const char *value);
-    stringlist_t expandlist(const char *key, const char *value);
 
     // Value is assigned to field if the new match is less or equal the current
     // match. Newer entries of same match override older ones.
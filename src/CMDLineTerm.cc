@@ -26,7 +26,9 @@
 #include <optional>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <utility>
 
 #include "CMDLineAssembler.hh"
@@ -46,14 +48,103 @@ inline namespace assembler_functions
 //
 // We use a temporary shell script in place of <arguments> to convert our
 // command line to a single argument.
-//
+
+// If remove_path isn't empty, the script deletes it. If close_fd isn't -1,
+// the script closes it before executing the command.
+static std::string
+format_term_emulator_script(const std::vector<std::string> &commandline,
+                            std::string_view app_name,
+                            std::string_view remove_path, int close_fd = -1) {
+    using CMDLineAssembly::sq_quote;
+
+    std::string result = "#!/bin/sh\n";
+    // Passing remove_path unquoted is safe, it can not contain user data
+    if (!remove_path.empty())
+        result += fmt::format("rm {}\n", remove_path);
+    if (close_fd != -1)
+        result += fmt::format("exec {}<&-\n", close_fd);
+    // Set window title through an escape sequence
+    result +=
+        fmt::format("printf '\\033]2;%s\\007' {}\n", sq_quote(app_name));
+    result += fmt::format("exec {}\n",
+                          CMDLineAssembly::convert_argv_to_string(commandline));
+    return result;
+}
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+// The script is kept in an anonymous file. The file descriptor is
+// intentionally inherited by the terminal emulator, the script is
+// accessible through /proc for as long as the terminal emulator is running.
+// The shell running the script closes its inherited copy of the descriptor,
+// so that it doesn't leak into the executed program.
+static std::optional<std::string>
+create_term_emulator_memfd_script(const std::vector<std::string> &commandline,
+                                  std::string_view app_name) {
+    static bool have_proc = access("/proc/self/fd", F_OK) == 0;
+    if (!have_proc)
+        return {};
+
+    unsigned int flags = 0;
+#ifdef MFD_EXEC
+    // Kernels with vm.memfd_noexec support may make memfds non-executable by
+    // default.
+    flags |= MFD_EXEC;
+#endif
+    int fd = memfd_create("j4-dmenu-script", flags);
+    // Older kernels reject unknown flags.
+    if (fd == -1 && errno == EINVAL && flags != 0)
+        fd = memfd_create("j4-dmenu-script", 0);
+    if (fd == -1) {
+        SPDLOG_DEBUG("Couldn't create in-memory script, falling back to "
+                     "/tmp: memfd_create: {}",
+                     strerror(errno));
+        return {};
+    }
+    // POSIX shells are required to support only single digit file
+    // descriptors in redirections.
+    if (fd > 9) {
+        SPDLOG_DEBUG("Couldn't create in-memory script, falling back to "
+                     "/tmp: memfd_create returned file descriptor {}",
+                     fd);
+        close(fd);
+        return {};
+    }
+
+    std::string content =
+        format_term_emulator_script(commandline, app_name, {}, fd);
+    if (writen(fd, content.data(), content.size()) == -1) {
+        SPDLOG_DEBUG("Couldn't write in-memory script, falling back to /tmp: "
+                     "{}",
+                     strerror(errno));
+        close(fd);
+        return {};
+    }
+
+    return fmt::format("/proc/{}/fd/{}", getpid(), fd);
+}
+#else
+static std::optional<std::string>
+create_term_emulator_memfd_script(const std::vector<std::string> &,
+                                  std::string_view) {
+    return {};
+}
+#endif
+
+static bool in_memory_scripts = false;
+
 // Filename of script is returned. It is safe to use it unquoted in shell
 // context.
 static std::string
 create_term_emulator_temp_script(const std::vector<std::string> &commandline,
                                  std::string_view app_name) {
     using namespace std::literals;
-    using CMDLineAssembly::sq_quote;
+
+    if (in_memory_scripts) {
+        auto result =
+            create_term_emulator_memfd_script(commandline, app_name);
+        if (result)
+            return *result;
+    }
 
     char scriptname[] = "/tmp/j4-dmenu-XXXXXX";
 
@@ -70,13 +161,8 @@ create_term_emulator_temp_script(const std::vector<std::string> &commandline,
 
     FILE *script = fdopen(fd, "w");
 
-    fmt::print(script, "#!/bin/sh\n");
-    // Passing scriptname unquoted is safe, it can not contain user data
-    fmt::print(script, "rm {}\n", scriptname);
-    // Set window title through an escape sequence
-    fmt::print(script, "printf '\\033]2;%s\\007' {}\n", sq_quote(app_name));
-    fmt::print(script, "exec {}\n",
-               CMDLineAssembly::convert_argv_to_string(commandline));
+    fmt::print(script, "{}",
+               format_term_emulator_script(commandline, app_name, scriptname));
 
     if (fclose(script) == EOF)
         throw initialization_error(
@@ -382,4 +468,8 @@ custom_term_assembler(const std::vector<std::string> &commandline,
     return args;
 }
 }; // namespace assembler_functions
+
+void set_in_memory_scripts(bool enable) {
+    in_memory_scripts = enable;
+}
 }; // namespace CMDLineTerm
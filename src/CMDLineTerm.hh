@@ -56,6 +56,19 @@ term_assembler_func custom_term_assembler;
 // This function terminates the program if term_arg is malformed.
 void validate_custom_term(std::string_view term_arg);
 }; // namespace assembler_functions
+
+// Create temporary scripts used by default_term_assembler() and by {script}
+// in custom_term_assembler() in memory (through memfd_create()) instead of in
+// /tmp. The script is then accessed through /proc/<pid>/fd/<fd>, so it stays
+// available only as long as the process which has created it (and which
+// exec()s the terminal emulator) is alive. This should be enabled only if
+// j4dd executes the terminal emulator directly (no wrapper, no i3 IPC) and if
+// the terminal emulator runs the script itself instead of handing it over to
+// another process (like a terminal server or a detaching wrapper).
+//
+// This is disabled by default. If memfd_create() or /proc isn't available,
+// scripts are created in /tmp regardless of this setting.
+void set_in_memory_scripts(bool enable);
 }; // namespace CMDLineTerm
 
 #endif
@@ -26,6 +26,8 @@
 #include <unistd.h>
 #include <utility>
 
+#include "Probes.hh"
+#include "Tracer.hh"
 #include "Utilities.hh"
 
 Dmenu::Dmenu(std::string dmenu_command, const char *sh)
@@ -45,6 +47,7 @@ void Dmenu::display() {
 }
 
 std::string Dmenu::read_choice() {
+    Tracer::Span span("dmenu read");
     int status;
     waitpid(this->pid, &status, 0);
 
@@ -86,6 +89,7 @@ void Dmenu::run() {
     // used
 
     SPDLOG_DEBUG("Dmenu: Running Dmenu.");
+    Tracer::Span span("dmenu spawn");
 
     if (pipe(this->inpipe.data()) == -1 || pipe(this->outpipe.data()) == -1)
         throw std::runtime_error("Dmenu::create(): pipe() failed");
@@ -111,6 +115,7 @@ void Dmenu::run() {
         SPDLOG_ERROR("Couldn't execute dmenu!");
         _exit(EXIT_FAILURE);
     }
+    J4DD_PROBE1(dmenu_spawn, this->pid);
 
     close(this->inpipe[1]);
     close(this->outpipe[0]);
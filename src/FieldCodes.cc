@@ -20,110 +20,147 @@
 #include <algorithm>
 #include <iterator>
 #include <stdexcept>
+#include <utility>
 
 #include "Application.hh"
+#include "CMDLineAssembler.hh"
 #include "Utilities.hh"
 
+static ExecTemplate::Argument compile_argument(std::string arg,
+                                               const Application &app) {
+    ExecTemplate::Argument result;
+
+    auto field_code_pos = arg.find('%');
+
+    // Most arguments do not contain field codes at all. Only the first field
+    // code in an argument is expanded.
+    if (field_code_pos == std::string::npos) {
+        result.prefix = std::move(arg);
+        return result;
+    }
+
+    if (field_code_pos == arg.size() - 1)
+        throw std::runtime_error("Invalid field code at the end of Exec.");
+
+    switch (arg[field_code_pos + 1]) {
+    case '%':
+        arg.replace(field_code_pos, 2, "%");
+        break;
+    case 'f': // this isn't exactly to the spec, we expect that the user
+              // specified correct arguments
+    case 'F':
+    case 'u':
+    case 'U':
+        result.has_file_field_code = true;
+        result.suffix = arg.substr(field_code_pos + 2);
+        arg.erase(field_code_pos);
+        break;
+    case 'c':
+        arg.replace(field_code_pos, 2, app.name);
+        break;
+    case 'k':
+        arg.replace(field_code_pos, 2, app.location);
+        break;
+    case 'i': // icons aren't handled
+    case 'd': // ignore deprecated entries
+    case 'D':
+    case 'n':
+    case 'N':
+    case 'v':
+    case 'm':
+        break;
+    default:
+        throw std::runtime_error((std::string) "Invalid field code %" +
+                                 arg[field_code_pos + 1] + '.');
+    }
+
+    result.prefix = std::move(arg);
+    return result;
+}
+
+static stringlist_t split_user_arguments(const std::string &user_arguments) {
+    auto result = split(user_arguments, ' ');
+    // Remove empty elements.
+    result.erase(std::remove(result.begin(), result.end(), std::string()),
+                 result.end());
+    return result;
+}
+
+static void expand_argument(const ExecTemplate::Argument &arg,
+                            const std::string &user_arguments,
+                            const stringlist_t &split_user_args,
+                            std::vector<std::string> &out) {
+    if (!arg.has_file_field_code) {
+        out.push_back(arg.prefix);
+        return;
+    }
+
+    if (split_user_args.empty()) {
+        // If the argument doesn't contain anything except the field code,
+        // remove the argument. I think that this is the best way to make
+        // desktop files using %f, %F, %u and %U work as expected when no
+        // arguments are given. Otherwise remove the field code and leave the
+        // rest of the argument as is. This behavior may be subject to change.
+        if (!arg.prefix.empty() || !arg.suffix.empty())
+            out.push_back(arg.prefix + arg.suffix);
+    } else if (split_user_args.size() == 1) {
+        out.push_back(arg.prefix + user_arguments + arg.suffix);
+    } else {
+        // If the provided Exec argument is "1234%f5678" and user arguments are
+        // {"first", "second", "third"}, the Exec argument shall be expandend
+        // into three arguments, resulting in {"1234first", "second",
+        // "third5678"}. This likely won't happen in real desktop files. Most
+        // desktop files have this field code as a standalone argument (such as
+        // "%f"). In that case, the argument containing the sole field code
+        // will be replaced by split_user_args.
+        out.push_back(arg.prefix + split_user_args.front());
+        out.insert(out.end(), std::next(split_user_args.cbegin()),
+                   std::prev(split_user_args.cend()));
+        out.push_back(split_user_args.back() + arg.suffix);
+    }
+}
+
 void expand_field_codes(std::vector<std::string> &args, const Application &app,
                         const std::string &user_arguments) {
-    for (auto iter = args.begin(); iter != args.end(); ++iter) {
-        std::string &arg = *iter;
-        auto field_code_pos = arg.find('%');
-
-        // Most arguments do not contain field codes at all. If the following if
-        // condition is true, this loop is interrupted early and no further
-        // processing on the argument is done.
-        if (field_code_pos == std::string::npos)
-            continue;
-
-        if (field_code_pos == arg.size() - 1)
-            throw std::runtime_error("Invalid field code at the end of Exec.");
-
-        switch (arg[field_code_pos + 1]) {
-        case '%':
-            arg.replace(field_code_pos, 2, "%");
-            break;
-        case 'f': // this isn't exactly to the spec, we expect that the user
-                  // specified correct arguments
-        case 'F':
-        case 'u':
-        case 'U': {
-            auto split_user_arguments = split(user_arguments, ' ');
-            // Remove empty elements.
-            split_user_arguments.erase(std::remove(split_user_arguments.begin(),
-                                                   split_user_arguments.end(),
-                                                   std::string()),
-                                       split_user_arguments.end());
-            if (split_user_arguments.empty()) {
-                // If the argument doesn't contain anything except the field
-                // code...
-                if (field_code_pos == 0 && arg.size() == 2) {
-                    // remove the argument. I think that this is the best way to
-                    // make desktop files using %f, %F, %u and %U work as
-                    // expected when no arguments are given. This behavior may
-                    // be subject to change.
-                    iter = args.erase(iter);
-
-                    // This check is necessary, the for loop would otherwise
-                    // continue which could lead to incrementing a past the end
-                    // iterator which is UB.
-                    if (iter == args.end())
-                        return;
-                } else {
-                    // Otherwise remove the field code and leave the rest of the
-                    // argument as is. As noted above, this behavior may be
-                    // subject to change.
-                    arg.erase(field_code_pos, 2);
-                }
-            } else if (split_user_arguments.size() == 1) {
-                arg.replace(field_code_pos, 2, user_arguments);
-            } else {
-                // If the provided Exec argument is "1234%f5678" and user
-                // arguments are {"first", "second", "third"}, the Exec argument
-                // shall be expandend into two arguments, resulting in
-                // {"1234first", "second", "third5678"}. This likely won't
-                // happen in real desktop files. Most desktop files have this
-                // field code as a standalone argument (such as "%f"). In that
-                // case, the following code will behave as if the single element
-                // of args vector containing the sole field code will be
-                // replaced by split_user_arguments.
-                std::string suffix;
-                if (field_code_pos + 2 < args.size())
-                    suffix = arg.substr(field_code_pos + 2);
-
-                arg.erase(field_code_pos);
-                arg += split_user_arguments.front();
-
-                iter = args.insert(std::next(iter),
-                                   std::next(split_user_arguments.cbegin()),
-                                   std::prev(split_user_arguments.cend()));
-                iter += split_user_arguments.size() - 2;
-                iter = args.insert(iter, split_user_arguments.back() + suffix);
-                ++iter;
-
-                // See comment above.
-                if (iter == args.end())
-                    return;
-            }
-            break;
-        } break;
-        case 'c':
-            arg.replace(field_code_pos, 2, app.name);
-            break;
-        case 'k':
-            arg.replace(field_code_pos, 2, app.location);
-            break;
-        case 'i': // icons aren't handled
-        case 'd': // ignore deprecated entries
-        case 'D':
-        case 'n':
-        case 'N':
-        case 'v':
-        case 'm':
-            break;
-        default:
-            throw std::runtime_error((std::string) "Invalid field code %" +
-                                     arg[field_code_pos + 1] + '.');
-        }
+    std::vector<std::string> result;
+    result.reserve(args.size());
+    stringlist_t split_user_args = split_user_arguments(user_arguments);
+
+    for (std::string &arg : args) {
+        expand_argument(compile_argument(std::move(arg), app), user_arguments,
+                        split_user_args, result);
+    }
+
+    args = std::move(result);
+}
+
+ExecTemplate::ExecTemplate(const Application &app) {
+    auto args = CMDLineAssembly::convert_exec_to_command(app.exec);
+    this->args.reserve(args.size());
+    try {
+        for (std::string &arg : args)
+            this->args.push_back(compile_argument(std::move(arg), app));
+    } catch (const std::runtime_error &e) {
+        this->error = e.what();
     }
 }
+
+std::vector<std::string>
+ExecTemplate::expand(const std::string &user_arguments) const {
+    if (!this->error.empty())
+        throw std::runtime_error(this->error);
+
+    std::vector<std::string> result;
+    result.reserve(this->args.size());
+
+    // Splitting is done only when necessary, user arguments are usually
+    // empty.
+    stringlist_t split_user_args;
+    if (!user_arguments.empty())
+        split_user_args = split_user_arguments(user_arguments);
+
+    for (const Argument &arg : this->args)
+        expand_argument(arg, user_arguments, split_user_args, result);
+
+    return result;
+}
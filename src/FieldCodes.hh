@@ -28,4 +28,36 @@ class Application;
 void expand_field_codes(std::vector<std::string> &args, const Application &app,
                         const std::string &user_arguments);
 
+// This is a preprocessed Exec key of a desktop app. It is split into arguments
+// and all field codes which don't depend on user arguments are already
+// expanded. Positions of the remaining field codes (%f, %F, %u and %U) are
+// recorded, so expand() only has to splice user arguments in.
+//
+// ExecTemplate(app).expand(args) is equivalent to
+// expand_field_codes(convert_exec_to_command(app.exec), app, args).
+class ExecTemplate
+{
+public:
+    explicit ExecTemplate(const Application &app);
+
+    // This throws std::runtime_error if the Exec key contains invalid field
+    // codes.
+    std::vector<std::string> expand(const std::string &user_arguments) const;
+
+    struct Argument
+    {
+        // If has_file_field_code is false, this is the entire argument.
+        // Otherwise it is the part of the argument preceding the field code.
+        std::string prefix;
+        // Part of the argument following %f, %F, %u or %U.
+        std::string suffix;
+        bool has_file_field_code = false;
+    };
+
+private:
+    std::vector<Argument> args;
+    // Errors are reported by expand() to behave like expand_field_codes().
+    std::string error;
+};
+
 #endif
@@ -18,15 +18,23 @@
 #include "HistoryManager.hh"
 
 #include <fmt/core.h>
+#include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
 #include <cctype>
+#include <charconv>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <errno.h>
+#include <iterator>
+#include <locale.h>
 #include <optional>
 #include <string.h>
 #include <string_view>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <tuple>
 #include <unistd.h>
 #include <unordered_set>
@@ -36,6 +44,17 @@
 #include "Application.hh"
 #include "LineReader.hh"
 
+// Compaction never happens before the journal has this many records.
+constexpr static size_t min_compaction_threshold = 256;
+
+// Frecency score of an app halves every two weeks.
+constexpr static double frecency_half_life = 14 * 24 * 60 * 60;
+
+// See the comment at the top of HistoryManager.hh.
+static double get_frecency_key(double score, time_t last_used) {
+    return std::log2(score) + last_used / frecency_half_life;
+}
+
 constexpr static int compare_versions(unsigned int major, unsigned int minor) {
     auto major_diff =
         (major > J4DDHIST_MAJOR_VERSION) - (J4DDHIST_MAJOR_VERSION > major);
@@ -52,53 +71,100 @@ constexpr static int compare_versions(unsigned int major, unsigned int minor) {
         return major_diff;
 }
 
-HistoryManager::HistoryManager(const string &path)
-    : file(std::fopen(path.c_str(), "r+")), filename(path) {
-    // We first try to open the file in the initializer list. If that
-    // doesn't work, we go for fallback.
-    if (!this->file) {
-        this->file.reset(fopen(path.c_str(), "w"));
-        if (!this->file)
-            throw std::runtime_error("Couldn't open file '" + path +
+static void lock_file(int fd, int operation, const string &path) {
+    while (flock(fd, operation) == -1) {
+        if (errno != EINTR)
+            throw std::runtime_error("Couldn't lock history file '" + path +
                                      "': " + strerror(errno));
+    }
+}
+
+HistoryManager::HistoryManager(const string &path) : filename(path) {
+    load();
+}
+
+void HistoryManager::load() {
+    const string &path = this->filename;
+
+    this->index.clear();
+    this->frecency.clear();
+    this->history.clear();
+    this->journal_records = 0;
+    this->needs_compaction = false;
+    this->is_legacy = false;
+    this->file_offset = 0;
+    this->modified = true;
+
+    this->file.reset(std::fopen(path.c_str(), "a+"));
+    if (!this->file)
+        throw std::runtime_error("Couldn't open file '" + path +
+                                 "': " + strerror(errno));
+
+    int fd = fileno(this->file.get());
+
+    // Writers hold an exclusive lock, so the file can't contain a partially
+    // written record while it's being read.
+    lock_file(fd, LOCK_SH, path);
+    OnExit unlock = [fd]() { flock(fd, LOCK_UN); };
+
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+        throw std::runtime_error("Couldn't stat file '" + path +
+                                 "': " + strerror(errno));
+    this->file_dev = sb.st_dev;
+    this->file_ino = sb.st_ino;
+    if (sb.st_size == 0) {
+        // The file has just been created. The header will be written on
+        // first write.
+        this->needs_compaction = true;
         return;
     }
 
-    FILE *f = this->file.get();
-    LineReader liner;
+    // The whole file is read at once and parsed in memory. Large histories
+    // would otherwise spend most of the time in stdio calls.
+    string contents(sb.st_size, '\0');
+    ssize_t read_size;
+    if (lseek(fd, 0, SEEK_SET) == -1 ||
+        (read_size = readn(fd, contents.data(), contents.size())) == -1)
+        throw std::runtime_error("Couldn't read history file '" + path +
+                                 "': " + strerror(errno));
+    contents.resize(read_size);
+    std::string_view data = contents;
 
     // Check whether the header is there. If not, the history file is either
     // invalid or it's using the old version which didn't have the history
     // header yet.
-    char start[J4DDHIST_HEADER_LENGTH];
-    auto rcount = std::fread(start, J4DDHIST_HEADER_LENGTH, 1, f);
-    if (rcount != 1 ||
-        memcmp(start, J4DDHIST_HEADER, J4DDHIST_HEADER_LENGTH) != 0) {
-        if (is_v0(liner))
+    if (!startswith(data, J4DDHIST_HEADER)) {
+        if (is_v0(data))
             throw v0_version_error("History file '" + path + "' is outdated!");
         else
             throw std::runtime_error("History file '" + path +
                                      "' is malformed!");
     }
+    data.remove_prefix(J4DDHIST_HEADER_LENGTH);
 
     unsigned int major, minor;
-    auto err = std::fscanf(f, "%u.%u", &major, &minor);
-    if (err == EOF)
+    const char *data_end = data.data() + data.size();
+    auto [major_end, major_err] = std::from_chars(data.data(), data_end, major);
+    if (major_err != std::errc() || major_end == data_end ||
+        *major_end != '.')
         throw std::runtime_error("Couldn't read history file version of '" +
-                                 path + "': " + strerror(errno));
-    else if (err != 2)
-        // This is probably impossible to happen, but there are never enough
-        // checks.
+                                 path + "'!");
+    auto [minor_end, minor_err] =
+        std::from_chars(major_end + 1, data_end, minor);
+    if (minor_err != std::errc())
         throw std::runtime_error("Couldn't read history file version of '" +
                                  path + "'!");
     // Get rid of the newline. This completes the reading of the header.
     // Actual data will follow.
-    if (std::fgetc(f) != '\n')
+    if (minor_end == data_end || *minor_end != '\n')
         throw std::runtime_error("Format error in history file '" + path +
                                  "'!");
+    data.remove_prefix(minor_end + 1 - data.data());
 
+    this->is_legacy = (major == 1 || major == 2) && minor == 0;
     auto cmp = compare_versions(major, minor);
-    if (cmp != 0) {
+    if (cmp != 0 && !this->is_legacy) {
         throw std::runtime_error(
             (string) "History file is incompatible with the current build "
                      "of j4-dmenu-desktop! History file format is too " +
@@ -108,66 +174,339 @@ HistoryManager::HistoryManager(const string &path)
             std::to_string(major) + '.' + std::to_string(minor));
     }
 
-    read_file(path, liner);
+    this->file_offset = data.data() - contents.data();
+    this->file_offset +=
+        read_file(path, data, major == 2, !this->is_legacy, sb.st_mtime);
+
+    if (this->is_legacy) {
+        SPDLOG_INFO("History file '{}' is using format {}.{}, it will be "
+                    "converted to format " J4DDHIST_VERSION " on first write.",
+                    path, major, minor);
+        this->needs_compaction = true;
+    }
+
+    if (evict(nullptr, false) != 0)
+        this->needs_compaction = true;
 }
 
-HistoryManager::HistoryManager(HistoryManager &&other)
-    : file(std::move(other.file)), history(std::move(other.history)),
-      filename(other.filename) {}
+// Iterators of history and frecency stay valid (and point into the new
+// containers) after a move, so index can be moved along with them.
+HistoryManager::HistoryManager(HistoryManager &&other) {
+    *this = std::move(other);
+}
 
 HistoryManager &HistoryManager::operator=(HistoryManager &&other) {
     if (this != &other) {
         this->file = std::move(other.file);
         this->history = std::move(other.history);
+        this->frecency = std::move(other.frecency);
+        this->index = std::move(other.index);
+        this->journal_records = other.journal_records;
+        this->queued_records = std::move(other.queued_records);
+        this->queued_record_count = std::exchange(other.queued_record_count, 0);
+        this->needs_compaction = other.needs_compaction;
+        this->is_legacy = other.is_legacy;
+        this->capacity = other.capacity;
+        this->modified = other.modified;
+        this->file_offset = other.file_offset;
+        this->file_dev = other.file_dev;
+        this->file_ino = other.file_ino;
         this->filename = std::move(other.filename);
     }
     return *this;
 }
 
-void HistoryManager::increment(const string &name) {
-    auto result = std::find_if(this->history.begin(), this->history.end(),
-                               [&name](const std::pair<int, string> &val) {
-                                   return val.second == name;
-                               });
-    if (result == this->history.end())
-        history.emplace(std::piecewise_construct, std::forward_as_tuple(1),
-                        std::forward_as_tuple(name));
-    else {
-        history.emplace(std::piecewise_construct,
-                        std::forward_as_tuple(result->first + 1),
-                        std::forward_as_tuple(name));
-        history.erase(result);
+void HistoryManager::bump(const string &name, time_t now) {
+    this->modified = true;
+    auto result = this->index.find(name);
+    if (result == this->index.end()) {
+        add_entry(1, name, now, 1);
+        return;
+    }
+    Entry &entry = result->second;
+
+    // The nodes are re-inserted instead of reallocated to keep the key of
+    // index valid. Like emplace(), insert() places them after all elements
+    // with the same key.
+    auto node = this->history.extract(entry.count_iter);
+    ++node.key();
+    entry.count_iter = this->history.insert(std::move(node));
+
+    // Time can go backwards when the system clock is adjusted, the score
+    // isn't decayed in that case.
+    if (now > entry.last_used) {
+        entry.score *= std::exp2((entry.last_used - now) / frecency_half_life);
+        entry.last_used = now;
     }
-    write();
+    entry.score += 1;
+    auto frecency_node = this->frecency.extract(entry.frecency_iter);
+    frecency_node.key() = get_frecency_key(entry.score, entry.last_used);
+    entry.frecency_iter = this->frecency.insert(std::move(frecency_node));
 }
 
-HistoryManager::history_mmap_type::iterator
-HistoryManager::remove_obsolete_entry(history_mmap_type::const_iterator iter) {
-    auto result = this->history.erase(iter);
-    write();
-    return result;
+bool HistoryManager::add_entry(int count, string name, time_t last_used,
+                               double score) {
+    this->modified = true;
+    // Entries are usually added in order (when reading the base snapshot) or
+    // they have the lowest count (when they are new), so the hint is usually
+    // correct.
+    auto iter =
+        this->history.emplace_hint(this->history.end(), count, std::move(name));
+    auto [index_iter, inserted] = this->index.try_emplace(iter->second);
+    if (!inserted) {
+        this->history.erase(iter);
+        return false;
+    }
+    index_iter->second = {
+        iter,
+        this->frecency.emplace(get_frecency_key(score, last_used),
+                               &iter->second),
+        last_used, score};
+    return true;
+}
+
+void HistoryManager::erase(index_type::iterator iter) {
+    this->modified = true;
+    auto count_iter = iter->second.count_iter;
+    this->frecency.erase(iter->second.frecency_iter);
+    // The key of index points into the history node, so it must be erased
+    // first.
+    this->index.erase(iter);
+    this->history.erase(count_iter);
+}
+
+void HistoryManager::increment(const string &name, time_t now) {
+    queue_increment(name, now);
+    flush();
+}
+
+void HistoryManager::queue_increment(const string &name, time_t now) {
+    bump(name, now);
+    fmt::format_to(std::back_inserter(this->queued_records), "+{},{}\n", now,
+                   name);
+    ++this->queued_record_count;
+    evict(&name, true);
+}
+
+void HistoryManager::set_capacity(size_t capacity) {
+    this->capacity = capacity;
+    if (evict(nullptr, false) != 0)
+        this->needs_compaction = true;
+}
+
+size_t HistoryManager::evict(const string *keep, bool record) {
+    if (this->capacity == 0)
+        return 0;
+
+    size_t evicted = 0;
+    while (this->history.size() > this->capacity) {
+        // The entry with the lowest frecency is the last one.
+        auto victim = std::prev(this->frecency.end());
+        if (keep != nullptr && *victim->second == *keep)
+            --victim;
+        const string &name = *victim->second;
+
+        SPDLOG_DEBUG("Evicting history entry '{}' from '{}'.", name,
+                     this->filename);
+        if (record) {
+            this->queued_records += '-' + name + '\n';
+            ++this->queued_record_count;
+        }
+        erase(this->index.find(name));
+        ++evicted;
+    }
+    return evicted;
+}
+
+void HistoryManager::remove_obsolete_entry(const string &name) {
+    auto iter = this->index.find(name);
+    if (iter == this->index.end())
+        return;
+    // The name must be copied, it is destroyed together with the node.
+    string record = '-' + name + '\n';
+    erase(iter);
+    this->queued_records += record;
+    ++this->queued_record_count;
+}
+
+bool HistoryManager::has_queued_records() const {
+    return this->queued_record_count != 0;
+}
+
+bool HistoryManager::flush_needs_compaction() const {
+    // The journal may grow up to the size of the base snapshot. This keeps
+    // the cost of compaction amortized constant per record.
+    return this->needs_compaction ||
+           this->journal_records + this->queued_record_count >
+               std::max(min_compaction_threshold, this->history.size());
 }
 
-void HistoryManager::write() {
-    FILE *f = this->file.get();
+void HistoryManager::flush() {
+    if (!has_queued_records())
+        return;
+
+    // Other processes may be using the file too. Records they have appended
+    // since the last read must be applied first, otherwise compaction would
+    // lose them.
+    lock_and_sync(LOCK_EX);
+    // compact() replaces file, which also releases the lock.
+    OnExit unlock = [this]() { flock(fileno(this->file.get()), LOCK_UN); };
+
+    if (flush_needs_compaction()) {
+        // The in-memory history already contains the queued changes.
+        compact();
+    } else {
+        // The records are written with a single write() to an O_APPEND file,
+        // so they can't be interleaved with records of other processes.
+        if (writen(fileno(this->file.get()), this->queued_records.data(),
+                   this->queued_records.size()) == -1)
+            throw std::runtime_error("Couldn't write to history file '" +
+                                     this->filename +
+                                     "': " + strerror(errno));
+        this->journal_records += this->queued_record_count;
+        // The file is locked, nobody else could have written to it.
+        this->file_offset += this->queued_records.size();
+    }
+    this->queued_records.clear();
+    this->queued_record_count = 0;
+}
+
+bool HistoryManager::sync() {
+    lock_and_sync(LOCK_SH);
+    flock(fileno(this->file.get()), LOCK_UN);
+    return std::exchange(this->modified, false);
+}
+
+void HistoryManager::lock_and_sync(int operation) {
+    while (true) {
+        lock_file(fileno(this->file.get()), operation, this->filename);
+
+        // If another process has compacted the history, the file has been
+        // replaced. It must be read again from the beginning.
+        struct stat sb;
+        if (stat(this->filename.c_str(), &sb) == 0 &&
+            sb.st_dev == this->file_dev && sb.st_ino == this->file_ino)
+            break;
+        flock(fileno(this->file.get()), LOCK_UN);
+
+        SPDLOG_DEBUG("History file '{}' has been replaced, reloading it.",
+                     this->filename);
+        load();
+        // Queued records haven't been written yet, they must be applied to the
+        // new history again. They aren't part of the journal.
+        auto journal_records = this->journal_records;
+        read_file(this->filename, this->queued_records, true, true, 0);
+        this->journal_records = journal_records;
+    }
+
+    // Legacy files can be appended to only by older versions of j4dd, which
+    // don't use locking. They will be compacted on first write anyway.
+    if (this->is_legacy)
+        return;
+
+    int fd = fileno(this->file.get());
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+        throw std::runtime_error("Couldn't stat file '" + this->filename +
+                                 "': " + strerror(errno));
+    if (sb.st_size <= this->file_offset)
+        return;
+
+    // Only the records appended since the last read are read.
+    string appended(sb.st_size - this->file_offset, '\0');
+    ssize_t read_size;
+    if (lseek(fd, this->file_offset, SEEK_SET) == -1 ||
+        (read_size = readn(fd, appended.data(), appended.size())) == -1)
+        throw std::runtime_error("Couldn't read history file '" +
+                                 this->filename + "': " + strerror(errno));
+    appended.resize(read_size);
+
+    SPDLOG_DEBUG("Reading {} bytes appended to history file '{}'.", read_size,
+                 this->filename);
+    this->file_offset +=
+        read_file(this->filename, appended, true, true, 0);
+    this->modified = true;
+}
+
+void HistoryManager::compact() {
+    // If the history file is a symlink, its target should be replaced.
+    string target = this->filename;
+    {
+        std::unique_ptr<char, decltype(&free)> resolved(
+            realpath(this->filename.c_str(), NULL), &free);
+        if (resolved)
+            target = resolved.get();
+    }
 
-    std::rewind(f);
-    if (ftruncate(fileno(f), 0) == -1)
-        throw std::runtime_error("Couldn't ftruncate '" + this->filename +
+    string temp_name = target + ".XXXXXX";
+    int fd = mkstemp(temp_name.data());
+    if (fd == -1)
+        throw std::runtime_error("Couldn't create temporary file '" +
+                                 temp_name + "': " + strerror(errno));
+    OnExit remove_temp = [&temp_name]() {
+        if (!temp_name.empty())
+            unlink(temp_name.c_str());
+    };
+
+    // Preserve permissions of the original file.
+    struct stat sb;
+    if (fstat(fileno(this->file.get()), &sb) == 0)
+        fchmod(fd, sb.st_mode & 07777);
+
+    std::unique_ptr<FILE, fclose_deleter> newf(fdopen(fd, "a+"));
+    if (!newf) {
+        close(fd);
+        throw std::runtime_error("Couldn't open temporary file '" + temp_name +
                                  "': " + strerror(errno));
-    std::fputs(J4DDHIST_HEADER TOSTRING(J4DDHIST_MAJOR_VERSION) "." TOSTRING(
-                   J4DDHIST_MINOR_VERSION) "\n",
-               f);
-    for (const auto &[hist, name] : this->history)
-        fmt::print(f, "{},{}\n", hist, name);
-    std::fflush(f);
+    }
+    FILE *f = newf.get();
+
+    std::fputs(J4DDHIST_HEADER J4DDHIST_VERSION "\n", f);
+    for (const auto &[hist, name] : this->history) {
+        const Entry &entry = this->index.at(name);
+        fmt::print(f, "{},{},{},{}\n", hist, entry.last_used, entry.score,
+                   name);
+    }
+    if (std::fflush(f) == EOF || fsync(fd) == -1)
+        throw std::runtime_error("Couldn't write temporary file '" +
+                                 temp_name + "': " + strerror(errno));
+
+    if (rename(temp_name.c_str(), target.c_str()) == -1)
+        throw std::runtime_error("Couldn't rename '" + temp_name + "' to '" +
+                                 target + "': " + strerror(errno));
+    temp_name.clear();
+
+    SPDLOG_DEBUG("Compacted history file '{}' ({} entries, {} journal "
+                 "records).",
+                 this->filename, this->history.size(), this->journal_records);
+
+    this->file = std::move(newf);
+    this->journal_records = 0;
+    this->needs_compaction = false;
+    this->is_legacy = false;
+    this->file_offset = ftello(f);
+    if (fstat(fd, &sb) == 0) {
+        this->file_dev = sb.st_dev;
+        this->file_ino = sb.st_ino;
+    }
 }
 
-const std::multimap<int, string, std::greater<int>> &
-HistoryManager::view() const {
+const HistoryManager::history_mmap_type &HistoryManager::view() const {
     return this->history;
 }
 
+const HistoryManager::frecency_mmap_type &
+HistoryManager::frecency_view() const {
+    return this->frecency;
+}
+
+std::size_t HistoryManager::owned_string_bytes() const {
+    std::size_t result = 0;
+    for (const auto &[count, name] : this->history)
+        result += MemoryStats::string_heap_bytes(name);
+    return result;
+}
+
 HistoryManager HistoryManager::convert_history_from_v0(const string &path,
                                                        const AppManager &appm) {
     std::unique_ptr<FILE, fclose_deleter> f(std::fopen(path.c_str(), "r"));
@@ -229,12 +568,15 @@ HistoryManager HistoryManager::convert_history_from_v0(const string &path,
     }
 
     f.reset();
-    // This file won't be actually used for appending, write() will rewind it
-    // to the beginning and then truncate it.
-    FILE *newf = fopen(path.c_str(), "a");
+    // This file won't be actually used for appending, compact() will replace
+    // it.
+    FILE *newf = fopen(path.c_str(), "a+");
+    if (newf == NULL)
+        throw std::runtime_error("Couldn't open file '" + path +
+                                 "' for conversion: " + strerror(errno));
 
     auto histm = HistoryManager(newf, result, path);
-    histm.write();
+    histm.compact();
     return histm;
 }
 
@@ -245,71 +587,150 @@ const std::string &HistoryManager::get_filename() const {
 HistoryManager::HistoryManager(
     FILE *f, std::multimap<int, string, std::greater<int>> hist,
     std::string filename)
-    : file(f), history(std::move(hist)), filename(std::move(filename)) {}
+    : file(f), filename(std::move(filename)) {
+    // Format v0 doesn't contain timestamps.
+    time_t now = time(NULL);
+    for (auto &[count, name] : hist)
+        add_entry(count, std::move(name), now, count);
+}
 
-bool HistoryManager::is_v0(LineReader &liner) {
-    FILE *f = this->file.get();
-    std::rewind(f);
+// Parse a number followed by a comma at the start of str. The number and the
+// comma are removed from str. Returns false if str doesn't start with them.
+template <typename T>
+static bool consume_field(std::string_view &str, T &value) {
+    // from_chars() would accept a leading minus sign.
+    if (str.empty() || !std::isdigit((unsigned char)str.front()))
+        return false;
+    const char *end = str.data() + str.size();
+    auto [ptr, err] = std::from_chars(str.data(), end, value);
+    if (err != std::errc() || ptr == end || *ptr != ',')
+        return false;
+    str.remove_prefix(ptr + 1 - str.data());
+    return true;
+}
 
-    enum { COUNT, FILENAME } state = COUNT;
+// std::from_chars() for floating point numbers isn't available in all standard
+// libraries (libc++ doesn't have it), strtod_l() with the "C" locale is used
+// instead.
+static bool consume_field(std::string_view &str, double &value) {
+    if (str.empty() || !std::isdigit((unsigned char)str.front()))
+        return false;
+    size_t comma = str.find(',');
+    if (comma == std::string_view::npos)
+        return false;
+    // strtod() would also accept hexadecimal numbers.
+    std::string_view field = str.substr(0, comma);
+    if (field.find_first_not_of("0123456789.eE+-") != std::string_view::npos)
+        return false;
+
+    static locale_t c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+    if (c_locale == (locale_t)0)
+        PFATALE("newlocale");
+
+    // strtod_l() needs a null terminated string.
+    std::string number(field);
+    char *end;
+    errno = 0;
+    value = strtod_l(number.c_str(), &end, c_locale);
+    if (errno == ERANGE || end != number.c_str() + number.size())
+        return false;
+    str.remove_prefix(comma + 1);
+    return true;
+}
 
+bool HistoryManager::is_v0(std::string_view contents) {
     // The file format is: [number],[filename which ends in .desktop]\n
-    int c;
-    while ((c = std::fgetc(f)) != EOF) {
-        if (state == COUNT) {
-            if (std::isdigit(c))
-                continue;
-            else if (c == ',') {
-                state = FILENAME;
-                continue;
-            } else {
-                return false;
-            }
-        } else {
-            auto rsize = liner.getline(f);
-            if (rsize == -1) {
-                return false;
-            }
-
-            char *line = liner.get_lineptr();
-
-            if (rsize < 9) {
-                return false;
-            }
-
-            if (memcmp(line + rsize - 9, ".desktop\n", 9) != 0) {
-                return false;
-            }
-            state = COUNT;
-        }
+    while (!contents.empty()) {
+        const char *newline = static_cast<const char *>(
+            memchr(contents.data(), '\n', contents.size()));
+        if (newline == nullptr)
+            return false;
+        std::string_view line(contents.data(), newline - contents.data());
+        contents.remove_prefix(line.size() + 1);
+
+        size_t comma = line.find_first_not_of("0123456789");
+        if (comma == std::string_view::npos || line[comma] != ',')
+            return false;
+        std::string_view filename = line.substr(comma + 1);
+        if (filename.size() < 8 ||
+            filename.substr(filename.size() - 8) != ".desktop")
+            return false;
     }
-
     return true;
 }
 
-void HistoryManager::read_file(const string &name, LineReader &liner) {
-    FILE *f = this->file.get();
+size_t HistoryManager::read_file(const string &name,
+                                 std::string_view contents, bool has_journal,
+                                 bool has_timestamps, time_t legacy_time) {
+    auto malformed_error = [&name](std::string_view line) {
+        return std::runtime_error("Error while reading history file '" + name +
+                                  "': Malformed history entry '" +
+                                  string(line) + "'!");
+    };
+    auto empty_error = [&name]() {
+        return std::runtime_error("Error while reading history file '" + name +
+                                  "': Empty history entry present!");
+    };
+
+    this->index.reserve(std::count(contents.begin(), contents.end(), '\n'));
+    const size_t size = contents.size();
+
+    while (!contents.empty()) {
+        const char *newline = static_cast<const char *>(
+            memchr(contents.data(), '\n', contents.size()));
+        if (newline == nullptr) {
+            // This can happen only if j4dd has been interrupted while
+            // appending to the journal.
+            SPDLOG_WARN("History file '{}' ends with an incomplete record, "
+                        "ignoring it.",
+                        name);
+            this->needs_compaction = true;
+            break;
+        }
+        const std::string_view line(contents.data(),
+                                    newline - contents.data());
+        contents.remove_prefix(line.size() + 1);
+        std::string_view rest = line;
+
+        if (has_journal && !line.empty() &&
+            (line[0] == '+' || line[0] == '-')) {
+            rest.remove_prefix(1);
+            time_t time = legacy_time;
+            if (has_timestamps && line[0] == '+' && !consume_field(rest, time))
+                throw malformed_error(line);
+            if (rest.empty())
+                throw empty_error();
+            string entry_name(rest);
+            if (line[0] == '+')
+                bump(entry_name, time);
+            else {
+                auto iter = this->index.find(entry_name);
+                if (iter != this->index.end())
+                    erase(iter);
+            }
+            ++this->journal_records;
+            continue;
+        }
 
-    unsigned int history_count;
+        // Base snapshot entries are not allowed after the journal.
+        unsigned long history_count;
+        if (this->journal_records != 0 || !consume_field(rest, history_count))
+            throw malformed_error(line);
 
-    int result;
-    while ((result = std::fscanf(f, "%u,", &history_count) == 1)) {
-        auto read_size = liner.getline(f);
-        if (read_size < 0) {
-            throw std::runtime_error("Error while reading history file '" +
-                                     name + "': " + strerror(errno));
-        }
+        time_t last_used = legacy_time;
+        double score = history_count;
+        if (has_timestamps &&
+            (!consume_field(rest, last_used) || !consume_field(rest, score) ||
+             !std::isfinite(score)))
+            throw malformed_error(line);
 
-        if (read_size == 1)
-            throw std::runtime_error("Error while reading history file '" +
-                                     name + "': Empty history entry present!");
+        if (rest.empty())
+            throw empty_error();
 
-        history.emplace(
-            std::piecewise_construct, std::forward_as_tuple(history_count),
-            std::forward_as_tuple(liner.get_lineptr(), read_size - 1));
+        if (!add_entry(history_count, string(rest), last_used, score))
+            SPDLOG_WARN("History file '{}' contains duplicate entry '{}'!",
+                        name, rest);
     }
 
-    if (result == -1)
-        throw std::runtime_error("Error while reading history file '" + name +
-                                 "': " + strerror(errno));
+    return size - contents.size();
 }
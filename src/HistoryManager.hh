@@ -24,20 +24,24 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <time.h>
 #include <type_traits>
+#include <unordered_map>
 
+#include "MemoryStats.hh"
 #include "Utilities.hh"
 
 class AppManager;
-class LineReader;
 
 using std::string;
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 
-#define J4DDHIST_MAJOR_VERSION 1
-#define J4DDHIST_MINOR_VERSION 0
+#define J4DDHIST_MAJOR_VERSION 2
+#define J4DDHIST_MINOR_VERSION 1
 #define J4DDHIST_VERSION                                                       \
     TOSTRING(J4DDHIST_MAJOR_VERSION) "." TOSTRING(J4DDHIST_MINOR_VERSION)
 #define J4DDHIST_HEADER "j4dd history v"
@@ -49,12 +53,45 @@ class v0_version_error final : public std::runtime_error
 };
 
 // This class employs a version management mechanism. This should simplify
-// changing the history format in the future. As of the time of writing, only
-// two formats of history file exist, and one one of them employs the versioning
+// changing the history format in the future. As of the time of writing, four
+// formats of history file exist, and two of them employ the versioning
 // mechanism. The "v0" version which doesn't have the version header has to be
 // handled specially. If new version of history file should be made, checking
 // the versions will involve only comparing the version in the header to the
 // current one.
+//
+// Format v1.0 contains "count,name" lines sorted by count. It can still be
+// read, it is converted to the current format on first write.
+//
+// Format v2.0 starts with "count,name" lines like v1.0 (this is the base
+// snapshot). It is followed by a journal. Every change of the history appends
+// a single record to the journal: "+name" increments the count of name,
+// "-name" removes it. When the journal grows too big, the history is compacted:
+// current state is written to a temporary file which is then rename()d over
+// the history file. An interrupted append can leave an incomplete last line,
+// which is ignored.
+//
+// Format v2.1 adds data needed for frecency ranking. Base snapshot lines are
+// "count,last_used,score,name", where last_used is the time of the last use
+// (in seconds since the Epoch) and score is the frecency score at that time.
+// Increments are recorded as "+time,name". Formats v1.0 and v2.0 can still be
+// read, their entries are treated as if they were last used when the history
+// file was last modified, with score equal to their count. They are converted
+// to the current format on first write.
+//
+// The frecency score decays exponentially with frecency_half_life. Every use
+// adds 1 to the decayed score. Comparing scores decayed to a common time t
+// gives the same result as comparing log2(score) + last_used / half_life, which
+// doesn't depend on t. This value is used as the key of the frecency ordering,
+// so the ordering never has to be recomputed as time passes and a single use
+// repositions a single entry.
+//
+// Several j4dd processes can share a history file. Writers lock it with
+// flock() and apply records appended by others before writing. Compaction
+// replaces the file, other processes notice that and reload it.
+//
+// Records can be queued instead of being written immediately. This allows j4dd
+// to start the selected application first and persist the history afterwards.
 
 // We need to do these things with the history:
 // 1) load it (if it exists)
@@ -64,7 +101,17 @@ class v0_version_error final : public std::runtime_error
 class HistoryManager
 {
 public:
-    using history_mmap_type = std::multimap<int, string, std::greater<int>>;
+    template <typename T>
+    using allocator_type =
+        MemoryStats::counting_allocator<T, MemoryStats::subsystem::history>;
+
+    using history_mmap_type =
+        std::multimap<int, string, std::greater<int>,
+                      allocator_type<std::pair<const int, string>>>;
+    // Values point to names stored in history_mmap_type.
+    using frecency_mmap_type =
+        std::multimap<double, const string *, std::greater<double>,
+                      allocator_type<std::pair<const double, const string *>>>;
     HistoryManager(const string &path);
     HistoryManager(HistoryManager &&other);
     HistoryManager &operator=(HistoryManager &&other);
@@ -72,10 +119,32 @@ public:
     HistoryManager(const HistoryManager &) = delete;
     void operator=(const HistoryManager &) = delete;
 
-    void increment(const string &name);
-    history_mmap_type::iterator
-    remove_obsolete_entry(history_mmap_type::const_iterator iter);
+    void increment(const string &name, time_t now = time(NULL));
+    // This updates the in-memory history immediately, but the change is
+    // written to the file only by flush().
+    void queue_increment(const string &name, time_t now = time(NULL));
+    // Write all queued records.
+    void flush();
+    // Limit the number of entries in history. When a new entry is added to a
+    // full history, the entry with the lowest frecency is removed. 0 means no
+    // limit, which is the default.
+    void set_capacity(size_t capacity);
+    // Apply changes made to the history file by other processes since it was
+    // last read. Returns true if the history has changed since the last call
+    // of sync() (including changes made by this process).
+    bool sync();
+    bool has_queued_records() const;
+    // Returns true if flush() would rewrite the whole file instead of just
+    // appending the queued records to it.
+    bool flush_needs_compaction() const;
+    // The removal is written to the file by the next flush().
+    void remove_obsolete_entry(const string &name);
+    // History ordered by use count.
     const history_mmap_type &view() const;
+    // History ordered by frecency.
+    const frecency_mmap_type &frecency_view() const;
+    // Heap bytes owned by names in history. This is used by MemoryStats.
+    std::size_t owned_string_bytes() const;
     static HistoryManager convert_history_from_v0(const string &path,
                                                   const AppManager &appm);
 
@@ -86,18 +155,80 @@ private:
     HistoryManager(FILE *f, std::multimap<int, string, std::greater<int>> hist,
                    std::string filename);
 
-    // This function tests whether file is the "v0.0" version of the history
-    // file. This version doesn't contain the header.
-    bool is_v0(LineReader &);
-
-    // This is called in the ctor. It is expected that file is open and the
-    // header has already been read.
-    void read_file(const string &name, LineReader &liner);
-
-    void write();
+    // This function tests whether contents of a file are the "v0.0" version
+    // of the history file. This version doesn't contain the header.
+    static bool is_v0(std::string_view contents);
+
+    // (Re)open the history file and read it.
+    void load();
+
+    // contents is the rest of the file after the header or a part of the
+    // journal. If has_timestamps is false, the file is in one of the legacy
+    // formats and legacy_time is used as the last use time of all entries.
+    // Returns the number of bytes read (an incomplete last record isn't
+    // read).
+    size_t read_file(const string &name, std::string_view contents,
+                     bool has_journal, bool has_timestamps, time_t legacy_time);
+
+    // Lock the file with flock() operation and apply changes made to it by
+    // other processes. The file is locked on return.
+    void lock_and_sync(int operation);
+
+    struct Entry
+    {
+        history_mmap_type::iterator count_iter;
+        frecency_mmap_type::iterator frecency_iter;
+        time_t last_used;
+        // Frecency score at last_used.
+        double score;
+    };
+    using index_type = std::unordered_map<
+        std::string_view, Entry, std::hash<std::string_view>,
+        std::equal_to<std::string_view>,
+        allocator_type<std::pair<const std::string_view, Entry>>>;
+
+    // These modify only the in-memory history.
+    void bump(const string &name, time_t now);
+    // Returns false if name is already present.
+    bool add_entry(int count, string name, time_t last_used, double score);
+    void erase(index_type::iterator iter);
+    // Remove entries with the lowest frecency until history fits into
+    // capacity. keep is never removed. If record is true, removals are queued
+    // as journal records. Returns the number of removed entries.
+    size_t evict(const string *keep, bool record);
+
+    // Write the whole history to a new file and atomically replace the
+    // current one with it.
+    void compact();
 
     std::unique_ptr<FILE, fclose_deleter> file;
     history_mmap_type history;
+    frecency_mmap_type frecency;
+    // This maps names to their nodes in history and frecency. Keys point to
+    // strings stored in history. Nodes are re-inserted with node handles when
+    // their count changes, so these strings never move.
+    index_type index;
+
+    // Number of journal records following the base snapshot.
+    size_t journal_records = 0;
+    // Records which haven't been written yet and their count.
+    string queued_records;
+    size_t queued_record_count = 0;
+    // This is true if the file isn't in the current format (it is empty or
+    // it's using a legacy format). It has to be compacted before appending to
+    // it.
+    bool needs_compaction = false;
+    bool is_legacy = false;
+    size_t capacity = 0;
+    // This is set on every change of history and reset by sync().
+    bool modified = false;
+
+    // Several j4dd processes can use the same history file. Each of them
+    // remembers how much of the file it has read and which file it is (it
+    // changes on compaction). Writers hold an exclusive flock() on the file.
+    off_t file_offset = 0;
+    dev_t file_dev = 0;
+    ino_t file_ino = 0;
 
     std::string filename;
 };
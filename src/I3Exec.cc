@@ -19,11 +19,13 @@
 
 #include "I3Exec.hh"
 
+#include <fmt/core.h>
 #include <spdlog/fmt/bin_to_hex.h>
 #include <spdlog/spdlog.h>
 
 #include <cstdint>
 #include <cstring>
+#include <errno.h>
 #include <exception>
 #include <limits>
 #include <memory>
@@ -33,14 +35,19 @@
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <utility>
 
 #include "Utilities.hh"
 
 using std::string;
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 namespace I3Interface
 {
-string get_ipc_socket_path() {
+static string query_ipc_socket_path() {
     int pipefd[2];
     if (pipe(pipefd) == -1)
         PFATALE("pipe");
@@ -100,6 +107,20 @@ string get_ipc_socket_path() {
     return result;
 }
 
+string get_ipc_socket_path() {
+    // Sway sets both of these variables. i3 doesn't set any of them, but the
+    // user might have.
+    for (const char *var : {"I3SOCK", "SWAYSOCK"}) {
+        string result = get_variable(var);
+        if (!result.empty()) {
+            SPDLOG_DEBUG("Using i3 IPC socket path '{}' from ${}.", result,
+                         var);
+            return result;
+        }
+    }
+    return query_ipc_socket_path();
+}
+
 struct JSONError : public std::exception
 {
     using std::exception::exception;
@@ -196,43 +217,118 @@ static string trim_spaces(const string &orig) {
     return result;
 }
 
-void exec(const string &command, const string &socket_path) {
-    // These are the base lengths (sum of message_base_header_length,
-    // message_base_command_length and command.length() should result in the
-    // payload length).
-    constexpr int message_base_header_length =
-        sizeof "i3-ipc" - 1 + sizeof(uint32_t) * 2;
-    constexpr int message_base_command_length = sizeof "exec " - 1;
+// Send the entire buffer. SIGPIPE is suppressed, the caller should handle
+// EPIPE instead.
+static bool sendn(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t written = send(fd, buf, n, MSG_NOSIGNAL);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += written;
+        n -= written;
+    }
+    return true;
+}
 
-    constexpr auto max_message_length =
-        std::numeric_limits<uint32_t>::max() - message_base_command_length;
-    if (command.size() > max_message_length) {
-        SPDLOG_ERROR("Command '{}' is too long! (expected <= {}, got {})",
-                     command, max_message_length, command.size());
-        exit(EXIT_FAILURE);
+Connection::Connection(std::string socket_path)
+    : socket_path(std::move(socket_path)) {
+    reconnect();
+}
+
+Connection::~Connection() {
+    if (this->sfd != -1)
+        close(this->sfd);
+}
+
+// Describe where the socket path came from for error messages. This mirrors
+// get_ipc_socket_path().
+static string describe_socket_path_origin(const string &path) {
+    for (const char *var : {"I3SOCK", "SWAYSOCK"}) {
+        if (get_variable(var) == path)
+            return fmt::format("${}", var);
     }
+    return "'sway --get-socketpath' or 'i3 --get-socketpath'";
+}
 
-    if (socket_path.size() >= sizeof(sockaddr_un::sun_path)) {
-        SPDLOG_ERROR(
-            "Socket address '{}' returned by 'i3 --get-socketpath' is too "
-            "long! (expected <= {}, got {})",
-            socket_path, sizeof(sockaddr_un::sun_path), socket_path.size());
+bool Connection::connect_to(const string &path) {
+    if (path.size() >= sizeof(sockaddr_un::sun_path)) {
+        SPDLOG_ERROR("Socket address '{}' from {} is too long! (expected <= "
+                     "{}, got {})",
+                     path, describe_socket_path_origin(path),
+                     sizeof(sockaddr_un::sun_path), path.size());
         exit(EXIT_FAILURE);
     }
 
-    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int sfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (sfd == -1)
         PFATALE("socket");
 
-    OnExit close_sfd = [sfd]() { close(sfd); };
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(sfd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
 
     struct sockaddr_un addr;
     std::memset(&addr, 0, sizeof(sockaddr_un));
     addr.sun_family = AF_UNIX;
-    std::memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+    std::memcpy(addr.sun_path, path.data(), path.size());
 
-    if (connect(sfd, (struct sockaddr *)&addr, sizeof(sockaddr_un)) == -1)
-        PFATALE("connect");
+    if (connect(sfd, (struct sockaddr *)&addr, sizeof(sockaddr_un)) == -1) {
+        int saved_errno = errno;
+        close(sfd);
+        errno = saved_errno;
+        return false;
+    }
+
+    this->sfd = sfd;
+    return true;
+}
+
+void Connection::reconnect() {
+    if (this->sfd != -1) {
+        close(this->sfd);
+        this->sfd = -1;
+    }
+
+    // Try the last known socket path first. If i3/Sway was restarted, it
+    // might be listening on a different path now.
+    if (connect_to(this->socket_path)) {
+        SPDLOG_DEBUG("Connected to i3 IPC socket '{}'.", this->socket_path);
+        return;
+    }
+    SPDLOG_INFO("Couldn't connect to i3 IPC socket '{}': {}. Looking up the "
+                "socket path again...",
+                this->socket_path, strerror(errno));
+
+    // This may abort()/exit()
+    string new_path = query_ipc_socket_path();
+    if (!connect_to(new_path)) {
+        SPDLOG_ERROR("Couldn't connect to i3 IPC socket '{}': {}", new_path,
+                     strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    SPDLOG_DEBUG("Connected to i3 IPC socket '{}'.", new_path);
+    this->socket_path = std::move(new_path);
+}
+
+void Connection::exec(const string &command) {
+    // These are the base lengths (sum of message_base_header_length,
+    // message_base_command_length and command.length() should result in the
+    // payload length).
+    constexpr int message_base_header_length =
+        sizeof "i3-ipc" - 1 + sizeof(uint32_t) * 2;
+    constexpr int message_base_command_length = sizeof "exec " - 1;
+
+    constexpr auto max_message_length =
+        std::numeric_limits<uint32_t>::max() - message_base_command_length;
+    if (command.size() > max_message_length) {
+        SPDLOG_ERROR("Command '{}' is too long! (expected <= {}, got {})",
+                     command, max_message_length, command.size());
+        exit(EXIT_FAILURE);
+    }
 
     uint32_t command_size = command.size() + message_base_command_length;
 
@@ -263,24 +359,43 @@ void exec(const string &command, const string &socket_path) {
                  spdlog::to_hex(payload.get(), payload.get() + payload_size));
 #endif
 
-    if (writen(sfd, payload.get(), payload_size) <= 0)
-        PFATALE("write");
+    if (this->sfd == -1)
+        reconnect();
+
+    if (!sendn(this->sfd, payload.get(), payload_size)) {
+        // i3/Sway has closed the connection. No part of the message could
+        // have been processed, so it is safe to send it again.
+        if (errno != EPIPE && errno != ECONNRESET && errno != ENOTCONN)
+            PFATALE("send");
+        SPDLOG_INFO("I3 IPC connection has been closed, reconnecting...");
+        reconnect();
+        if (!sendn(this->sfd, payload.get(), payload_size))
+            PFATALE("send");
+    }
+
+    // The command might have been already executed if the connection breaks
+    // here, so the message isn't resent.
+    auto read_or_die = [this](void *buf, size_t size) {
+        ssize_t result = readn(this->sfd, buf, size);
+        if (result < 0)
+            PFATALE("readn");
+        if ((size_t)result != size) {
+            SPDLOG_ERROR("I3 IPC connection has been closed unexpectedly!");
+            exit(EXIT_FAILURE);
+        }
+    };
 
     char unused_buf[6]; // This will contain the "i3-ipc" magic string
-    if (readn(sfd, unused_buf, sizeof unused_buf) < 0)
-        PFATALE("readn");
+    read_or_die(unused_buf, sizeof unused_buf);
 
     uint32_t message_length;
-    if (readn(sfd, &message_length, sizeof message_length) < 0)
-        PFATALE("readn");
+    read_or_die(&message_length, sizeof message_length);
 
     uint32_t unused_message_type;
-    if (readn(sfd, &unused_message_type, sizeof unused_message_type) < 0)
-        PFATALE("readn");
+    read_or_die(&unused_message_type, sizeof unused_message_type);
 
     string response(message_length, '\0');
-    if (readn(sfd, response.data(), message_length) < 0)
-        PFATALE("readn");
+    read_or_die(response.data(), message_length);
 
     SPDLOG_DEBUG("I3 IPC response: {}", response);
 
@@ -322,4 +437,8 @@ void exec(const string &command, const string &socket_path) {
         abort();
     }
 }
+
+void exec(const string &command, const string &socket_path) {
+    Connection(socket_path).exec(command);
+}
 }; // namespace I3Interface
@@ -26,7 +26,35 @@ namespace I3Interface
 {
 // Get the socket path required for i3_exec(). It is beneficial to call this
 // function early, because it will abort() if i3 isn't available.
+// $I3SOCK and $SWAYSOCK are checked first. 'sway --get-socketpath' or
+// 'i3 --get-socketpath' is executed only if they aren't set.
 std::string get_ipc_socket_path();
+
+// This is a persistent connection to i3/Sway IPC. It is established in ctor
+// and reused by all exec() calls. If i3/Sway closes the connection (because
+// it has been restarted for example), exec() reconnects transparently.
+class Connection
+{
+public:
+    Connection(std::string socket_path);
+    ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection(Connection &&) = delete;
+    void operator=(const Connection &) = delete;
+    void operator=(Connection &&) = delete;
+
+    void exec(const std::string &command);
+
+private:
+    bool connect_to(const std::string &path);
+    void reconnect();
+
+    std::string socket_path;
+    int sfd = -1;
+};
+
+// Open a new connection, execute command and close it.
 void exec(const std::string &command, const std::string &socket_path);
 }; // namespace I3Interface
 
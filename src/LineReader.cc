@@ -20,6 +20,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "MemoryStats.hh"
+
+using MemoryStats::subsystem;
+
 LineReader::LineReader() {}
 
 LineReader::LineReader(LineReader &&other)
@@ -30,6 +34,9 @@ LineReader::LineReader(LineReader &&other)
 LineReader &LineReader::operator=(LineReader &&other) {
     if (&other == this)
         return *this;
+    if (this->lineptr != NULL)
+        MemoryStats::record_deallocation(subsystem::line_reader, this->linesz);
+    free(this->lineptr);
     this->lineptr = other.lineptr;
     this->linesz = other.linesz;
 
@@ -39,11 +46,25 @@ LineReader &LineReader::operator=(LineReader &&other) {
 
 LineReader::~LineReader() {
     // lineptr is either valid or NULL; free() can be used in both states.
+    if (this->lineptr != NULL)
+        MemoryStats::record_deallocation(subsystem::line_reader, this->linesz);
     free(this->lineptr);
 }
 
 ssize_t LineReader::getline(FILE *f) {
-    return ::getline(&this->lineptr, &this->linesz, f);
+    char *old_lineptr = this->lineptr;
+    size_t old_linesz = this->linesz;
+    ssize_t result = ::getline(&this->lineptr, &this->linesz, f);
+    // getline() allocates or enlarges the buffer if needed.
+    if (this->lineptr != old_lineptr || this->linesz != old_linesz) {
+        if (old_lineptr != NULL)
+            MemoryStats::record_deallocation(subsystem::line_reader,
+                                             old_linesz);
+        if (this->lineptr != NULL)
+            MemoryStats::record_allocation(subsystem::line_reader,
+                                           this->linesz);
+    }
+    return result;
 }
 
 char *LineReader::get_lineptr() {
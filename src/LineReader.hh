@@ -40,14 +40,14 @@ public:
     ~LineReader();
 
     // This calls C's getline() under the hood, it has same error checking
-    // procedures (errno).
+    // procedures (errno). The size of the buffer is reported to MemoryStats.
     ssize_t getline(FILE *f);
 
     char *get_lineptr();
 
 private:
     char *lineptr = NULL;
-    size_t linesz;
+    size_t linesz = 0;
 };
 
 #endif
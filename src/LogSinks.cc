@@ -0,0 +1,218 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "LogSinks.hh"
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <utility>
+
+namespace LogSinks
+{
+FlightRecorderSink::FlightRecorderSink(
+    std::size_t capacity, std::shared_ptr<spdlog::sinks::sink> target)
+    : target(std::move(target)), capacity(capacity) {
+    this->ring.reserve(capacity);
+}
+
+void FlightRecorderSink::dump(const char *reason) {
+    std::lock_guard<spdlog::details::null_mutex> lock(this->mutex_);
+    dump_(reason);
+}
+
+void FlightRecorderSink::sink_it_(const spdlog::details::log_msg &msg) {
+    if (this->ring.size() < this->capacity)
+        this->ring.emplace_back(msg);
+    else {
+        this->ring[this->next] = spdlog::details::log_msg_buffer(msg);
+        this->next = (this->next + 1) % this->capacity;
+    }
+    if (msg.level >= spdlog::level::err)
+        dump_("an error has occurred");
+}
+
+void FlightRecorderSink::flush_() {
+    this->target->flush();
+}
+
+void FlightRecorderSink::dump_(const char *reason) {
+    // Levels of records have been checked when they were recorded.
+    std::string header =
+        fmt::format("Flight recorder dump ({}), {} records follow", reason,
+                    this->ring.size());
+    this->target->log(spdlog::details::log_msg(
+        spdlog::string_view_t(), spdlog::level::info, header));
+    for (std::size_t i = 0; i < this->ring.size(); ++i)
+        this->target->log(this->ring[(this->next + i) % this->ring.size()]);
+    this->target->log(spdlog::details::log_msg(
+        spdlog::string_view_t(), spdlog::level::info,
+        "End of flight recorder dump"));
+    this->target->flush();
+    this->ring.clear();
+    this->next = 0;
+}
+
+AsyncSink::AsyncSink(std::shared_ptr<spdlog::sinks::sink> target)
+    : target(std::move(target)) {
+    this->writer = std::make_unique<std::thread>(&AsyncSink::run, this);
+}
+
+AsyncSink::~AsyncSink() {
+    if (!this->writer)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stop = true;
+    }
+    this->cv.notify_one();
+    this->writer->join();
+}
+
+void AsyncSink::log(const spdlog::details::log_msg &msg) {
+    if (this->synchronous) {
+        this->target->log(msg);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->queue.emplace_back(msg);
+    }
+    this->cv.notify_one();
+}
+
+void AsyncSink::flush() {
+    if (this->synchronous) {
+        this->target->flush();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->flush_requested = true;
+    }
+    this->cv.notify_one();
+}
+
+void AsyncSink::set_pattern(const std::string &pattern) {
+    std::lock_guard<std::mutex> lock(this->target_mutex);
+    this->target->set_pattern(pattern);
+}
+
+void AsyncSink::set_formatter(
+    std::unique_ptr<spdlog::formatter> sink_formatter) {
+    std::lock_guard<std::mutex> lock(this->target_mutex);
+    this->target->set_formatter(std::move(sink_formatter));
+}
+
+void AsyncSink::make_synchronous() {
+    // The mutexes could have been locked by the writer during fork(), they
+    // can't be used anymore. The thread object is leaked, because the thread
+    // doesn't exist.
+    this->synchronous = true;
+    (void)this->writer.release();
+}
+
+void AsyncSink::run() {
+    std::vector<spdlog::details::log_msg_buffer> records;
+    bool should_flush;
+    bool should_stop;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.wait(lock, [this] {
+                return this->stop || this->flush_requested ||
+                       !this->queue.empty();
+            });
+            records.swap(this->queue);
+            should_flush = this->flush_requested;
+            should_stop = this->stop;
+            this->flush_requested = false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->target_mutex);
+            for (const auto &record : records)
+                this->target->log(record);
+            if (should_flush || should_stop)
+                this->target->flush();
+        }
+        records.clear();
+        if (should_stop)
+            return;
+    }
+}
+
+namespace
+{
+std::shared_ptr<FlightRecorderSink> installed_recorder;
+std::shared_ptr<AsyncSink> registered_async_sink;
+
+constexpr std::array<int, 5> fatal_signals = {SIGABRT, SIGSEGV, SIGBUS,
+                                              SIGFPE, SIGILL};
+std::array<struct sigaction, fatal_signals.size()> old_actions;
+
+void fatal_signal_handler(int sig) {
+    // This isn't async signal safe, but j4dd is going to die anyway.
+    if (installed_recorder)
+        installed_recorder->dump(strsignal(sig));
+    for (std::size_t i = 0; i < fatal_signals.size(); ++i) {
+        if (fatal_signals[i] == sig)
+            sigaction(sig, &old_actions[i], NULL);
+    }
+    raise(sig);
+}
+}; // namespace
+
+void install_flight_recorder(std::shared_ptr<FlightRecorderSink> recorder) {
+    installed_recorder = std::move(recorder);
+
+    struct sigaction act;
+    memset(&act, 0, sizeof act);
+    act.sa_handler = fatal_signal_handler;
+    for (std::size_t i = 0; i < fatal_signals.size(); ++i)
+        sigaction(fatal_signals[i], &act, &old_actions[i]);
+}
+
+bool dump_flight_recorder() {
+    if (!installed_recorder)
+        return false;
+    installed_recorder->dump();
+    return true;
+}
+
+void register_async_sink(std::shared_ptr<AsyncSink> sink) {
+    registered_async_sink = std::move(sink);
+
+    // Every forked child which can log needs after_fork(). Registering it
+    // here ensures that no fork() is forgotten.
+    static bool atfork_registered = false;
+    if (!atfork_registered) {
+        int err = pthread_atfork(nullptr, nullptr, after_fork);
+        if (err != 0)
+            SPDLOG_WARN("Couldn't register fork handler: {}", strerror(err));
+        atfork_registered = err == 0;
+    }
+}
+
+void after_fork() {
+    if (registered_async_sink)
+        registered_async_sink->make_synchronous();
+}
+}; // namespace LogSinks
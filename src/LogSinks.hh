@@ -0,0 +1,126 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Additional spdlog sinks used for logging into a file.
+//
+// FlightRecorderSink keeps the most recent records in memory and writes them
+// to the log file only when something goes wrong (an error is logged, j4dd
+// crashes) or when it is asked to (a --wait-on daemon command). Records are
+// stored with their formatted message, but timestamps, levels and source
+// locations are formatted only when they are dumped and nothing is written
+// until then.
+//
+// AsyncSink writes records to the log file in a separate thread so that the
+// --wait-on daemon doesn't wait for the disk.
+
+#ifndef LOGSINKS_DEF
+#define LOGSINKS_DEF
+
+#include <spdlog/details/log_msg.h>
+#include <spdlog/details/log_msg_buffer.h>
+#include <spdlog/details/null_mutex.h>
+#include <spdlog/formatter.h>
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/sinks/sink.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace LogSinks
+{
+class FlightRecorderSink final
+    : public spdlog::sinks::base_sink<spdlog::details::null_mutex>
+{
+public:
+    // capacity is the maximum number of records kept in memory. target must
+    // outlive the sink.
+    FlightRecorderSink(std::size_t capacity,
+                       std::shared_ptr<spdlog::sinks::sink> target);
+
+    // Write all recorded records to target and forget them. reason is
+    // mentioned in the header of the dump.
+    void dump(const char *reason = "requested");
+
+protected:
+    void sink_it_(const spdlog::details::log_msg &msg) override;
+    void flush_() override;
+
+private:
+    void dump_(const char *reason);
+
+    std::shared_ptr<spdlog::sinks::sink> target;
+    std::vector<spdlog::details::log_msg_buffer> ring;
+    std::size_t capacity;
+    // Index of the oldest record if ring is full.
+    std::size_t next = 0;
+};
+
+class AsyncSink final : public spdlog::sinks::sink
+{
+public:
+    explicit AsyncSink(std::shared_ptr<spdlog::sinks::sink> target);
+    ~AsyncSink();
+
+    AsyncSink(const AsyncSink &) = delete;
+    void operator=(const AsyncSink &) = delete;
+
+    void log(const spdlog::details::log_msg &msg) override;
+    void flush() override;
+    void set_pattern(const std::string &pattern) override;
+    void
+    set_formatter(std::unique_ptr<spdlog::formatter> sink_formatter) override;
+
+    // The writer thread doesn't exist in a forked child. Records are written
+    // directly after this has been called.
+    void make_synchronous();
+
+private:
+    void run();
+
+    std::shared_ptr<spdlog::sinks::sink> target;
+    std::vector<spdlog::details::log_msg_buffer> queue;
+    bool flush_requested = false;
+    bool stop = false;
+    bool synchronous = false;
+    // This protects the members above.
+    std::mutex mutex;
+    std::condition_variable cv;
+    // This protects target.
+    std::mutex target_mutex;
+    std::unique_ptr<std::thread> writer;
+};
+
+// Dump recorder when a fatal signal (including SIGABRT) is received and
+// make it available to dump_flight_recorder().
+void install_flight_recorder(std::shared_ptr<FlightRecorderSink> recorder);
+// Returns false if no flight recorder has been installed.
+bool dump_flight_recorder();
+
+// Register sink for make_synchronous() after fork. This also registers
+// after_fork() with pthread_atfork().
+void register_async_sink(std::shared_ptr<AsyncSink> sink);
+// This is called in every forked child once an async sink has been
+// registered.
+void after_fork();
+}; // namespace LogSinks
+
+#endif
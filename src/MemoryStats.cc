@@ -0,0 +1,83 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "MemoryStats.hh"
+
+#include <fmt/core.h>
+
+namespace MemoryStats
+{
+namespace
+{
+std::array<usage, subsystem_count> usages;
+}; // namespace
+
+void record_allocation(subsystem s, std::size_t bytes) {
+    usage &u = usages[(std::size_t)s];
+    u.live_bytes += bytes;
+    if (u.live_bytes > u.peak_bytes)
+        u.peak_bytes = u.live_bytes;
+    ++u.live_allocations;
+    ++u.total_allocations;
+}
+
+void record_deallocation(subsystem s, std::size_t bytes) {
+    usage &u = usages[(std::size_t)s];
+    u.live_bytes -= bytes;
+    --u.live_allocations;
+}
+
+const usage &get_usage(subsystem s) {
+    return usages[(std::size_t)s];
+}
+
+std::size_t string_heap_bytes(const std::string &str) {
+    static const std::size_t inline_capacity = std::string().capacity();
+    if (str.capacity() <= inline_capacity)
+        return 0;
+    // The terminating null character is allocated too.
+    return str.capacity() + 1;
+}
+
+std::string report(const owned_strings_type &owned_strings) {
+    std::string result = fmt::format(
+        "Memory usage:\n  {:<20}{:>14}{:>14}{:>14}{:>14}{:>15}\n", "subsystem",
+        "live bytes", "peak bytes", "live allocs", "total allocs",
+        "owned strings");
+    usage total;
+    std::size_t total_owned_strings = 0;
+    for (std::size_t i = 0; i < subsystem_count; ++i) {
+        const usage &u = usages[i];
+        result += fmt::format("  {:<20}{:>14}{:>14}{:>14}{:>14}{:>15}\n",
+                              subsystem_names[i], u.live_bytes, u.peak_bytes,
+                              u.live_allocations, u.total_allocations,
+                              owned_strings[i]);
+        total.live_bytes += u.live_bytes;
+        total.peak_bytes += u.peak_bytes;
+        total.live_allocations += u.live_allocations;
+        total.total_allocations += u.total_allocations;
+        total_owned_strings += owned_strings[i];
+    }
+    // Peaks of subsystems needn't happen at the same time, their sum is an
+    // upper bound.
+    result += fmt::format("  {:<20}{:>14}{:>14}{:>14}{:>14}{:>15}\n", "total",
+                          total.live_bytes, total.peak_bytes,
+                          total.live_allocations, total.total_allocations,
+                          total_owned_strings);
+    return result;
+}
+}; // namespace MemoryStats
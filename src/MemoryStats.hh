@@ -0,0 +1,126 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// MemoryStats accounts heap memory of the long-lived data structures of j4dd
+// by subsystem. Containers of a subsystem use counting_allocator, LineReader
+// reports its buffer directly. The allocator sees only the storage of the
+// containers themselves. Memory owned by their elements (for example by
+// strings of Application) is measured by walking the structures when a report
+// is made and it is reported separately. The counters aren't thread safe, all
+// accounted structures are used by the main thread only.
+
+#ifndef MEMORYSTATS_DEF
+#define MEMORYSTATS_DEF
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+namespace MemoryStats
+{
+enum class subsystem {
+    // AppManager::applications
+    applications,
+    // AppManager::name_app_mapping
+    name_app_mapping,
+    // The formatted map of NameToAppMapping
+    formatted_mapping,
+    // The copy of name_app_mapping in NameToAppMapping
+    raw_mapping,
+    // HistoryManager
+    history,
+    // Buffers of LineReader
+    line_reader,
+    count
+};
+
+constexpr std::size_t subsystem_count = (std::size_t)subsystem::count;
+
+constexpr std::array<const char *, subsystem_count> subsystem_names = {
+    "applications", "name_app_mapping", "formatted_mapping",
+    "raw_mapping",  "history",          "line_reader"};
+
+struct usage
+{
+    // Bytes which are currently allocated.
+    std::size_t live_bytes = 0;
+    // The highest value of live_bytes.
+    std::size_t peak_bytes = 0;
+    // Allocations which haven't been freed yet.
+    uint64_t live_allocations = 0;
+    // All allocations made so far.
+    uint64_t total_allocations = 0;
+};
+
+void record_allocation(subsystem s, std::size_t bytes);
+void record_deallocation(subsystem s, std::size_t bytes);
+
+const usage &get_usage(subsystem s);
+
+// Heap bytes owned by strings of the elements of each subsystem.
+using owned_strings_type = std::array<std::size_t, subsystem_count>;
+
+// Return the number of heap bytes owned by str (zero if str is stored inline
+// thanks to small string optimization).
+std::size_t string_heap_bytes(const std::string &str);
+
+// Return a table of all subsystems.
+std::string report(const owned_strings_type &owned_strings = {});
+
+// This is a std::allocator which reports its allocations to MemoryStats. It is
+// stateless, containers using it behave exactly like containers using
+// std::allocator.
+template <typename T, subsystem S> class counting_allocator
+{
+public:
+    using value_type = T;
+
+    template <typename U> struct rebind
+    {
+        using other = counting_allocator<U, S>;
+    };
+
+    counting_allocator() noexcept = default;
+    template <typename U>
+    counting_allocator(const counting_allocator<U, S> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        T *result = std::allocator<T>().allocate(n);
+        record_allocation(S, n * sizeof(T));
+        return result;
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        record_deallocation(S, n * sizeof(T));
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U>
+    bool operator==(const counting_allocator<U, S> &) const noexcept {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const counting_allocator<U, S> &) const noexcept {
+        return false;
+    }
+};
+}; // namespace MemoryStats
+
+#endif
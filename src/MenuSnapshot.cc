@@ -0,0 +1,446 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "MenuSnapshot.hh"
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits>
+#include <signal.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace MenuSnapshot
+{
+namespace
+{
+constexpr char snapshot_magic[8] = {'j', '4', 'd', 'd', 's', 'n', 'a', 'p'};
+constexpr uint32_t snapshot_version = 1;
+
+// Readers give up after this many failed seqlock retries. The daemon holds
+// the lock only for the duration of a memcpy(), so this shouldn't happen.
+constexpr int max_read_attempts = 64;
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t fingerprint;
+    // Odd while the daemon is writing to the snapshot.
+    uint64_t sequence;
+    // This is incremented on every publish().
+    uint64_t generation;
+    uint64_t payload_size;
+    int64_t pid;
+};
+
+// The payload is a sequence of length-prefixed strings and single byte
+// booleans. Numbers are stored in native byte order, the snapshot never
+// leaves the machine.
+class PayloadWriter
+{
+public:
+    void put_u32(uint32_t value) {
+        this->buffer.append(reinterpret_cast<const char *>(&value),
+                            sizeof value);
+    }
+
+    void put_bool(bool value) {
+        this->buffer.push_back(value ? 1 : 0);
+    }
+
+    void put_string(std::string_view str) {
+        put_u32(str.size());
+        this->buffer.append(str);
+    }
+
+    const std::string &get() const {
+        return this->buffer;
+    }
+
+private:
+    std::string buffer;
+};
+
+class PayloadReader
+{
+public:
+    PayloadReader(std::string_view payload) : payload(payload) {}
+
+    uint32_t get_u32() {
+        uint32_t result;
+        if (this->payload.size() < sizeof result)
+            throw std::runtime_error("Truncated snapshot payload!");
+        std::memcpy(&result, this->payload.data(), sizeof result);
+        this->payload.remove_prefix(sizeof result);
+        return result;
+    }
+
+    bool get_bool() {
+        if (this->payload.empty())
+            throw std::runtime_error("Truncated snapshot payload!");
+        bool result = this->payload.front() != 0;
+        this->payload.remove_prefix(1);
+        return result;
+    }
+
+    std::string get_string() {
+        uint32_t size = get_u32();
+        if (this->payload.size() < size)
+            throw std::runtime_error("Truncated snapshot payload!");
+        std::string result(this->payload.substr(0, size));
+        this->payload.remove_prefix(size);
+        return result;
+    }
+
+private:
+    std::string_view payload;
+};
+
+uint64_t load_sequence(const Header *header) {
+    return __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+}
+
+bool is_process_alive(pid_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+}; // namespace
+
+Entry::Entry(std::string formatted_name, bool is_generic, Application app)
+    : formatted_name(std::move(formatted_name)), is_generic(is_generic),
+      app(std::move(app)) {}
+
+PublishedEntry::PublishedEntry(std::string_view formatted_name,
+                               const Application *app, bool is_generic)
+    : formatted_name(formatted_name), app(app), is_generic(is_generic) {}
+
+uint64_t compute_fingerprint(const stringlist_t &settings) {
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const std::string &setting : settings) {
+        // The terminating NUL is hashed too to separate the settings.
+        const char *str = setting.c_str();
+        for (size_t i = 0; i <= setting.size(); ++i) {
+            hash ^= (unsigned char)str[i];
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+std::string get_snapshot_path(uint64_t fingerprint) {
+    std::string runtime_dir = get_variable("XDG_RUNTIME_DIR");
+    if (runtime_dir.empty())
+        return {};
+    if (runtime_dir.back() != '/')
+        runtime_dir += '/';
+    return fmt::format("{}j4-dmenu-desktop-{:016x}.snapshot", runtime_dir,
+                       fingerprint);
+}
+
+Publisher::Publisher(std::string path, uint64_t fingerprint)
+    : path(std::move(path)), fingerprint(fingerprint), owner(getpid()) {
+    // The snapshot is owned by the daemon which holds an exclusive lock on
+    // it. The owner unlinks the file before releasing the lock, so the lock
+    // must be taken again if the file has been replaced in the meantime.
+    while (true) {
+        this->fd =
+            open(this->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (this->fd == -1)
+            throw std::runtime_error("Couldn't open menu snapshot '" +
+                                     this->path + "': " + strerror(errno));
+        if (flock(this->fd, LOCK_EX | LOCK_NB) == -1) {
+            int saved_errno = errno;
+            close(this->fd);
+            this->fd = -1;
+            if (saved_errno == EINTR)
+                continue;
+            if (saved_errno == EWOULDBLOCK)
+                throw std::runtime_error(
+                    "Menu snapshot '" + this->path +
+                    "' is already published by another daemon.");
+            throw std::runtime_error("Couldn't lock menu snapshot '" +
+                                     this->path +
+                                     "': " + strerror(saved_errno));
+        }
+
+        struct stat opened, current;
+        if (fstat(this->fd, &opened) == 0 &&
+            stat(this->path.c_str(), &current) == 0 &&
+            opened.st_dev == current.st_dev && opened.st_ino == current.st_ino)
+            break;
+        close(this->fd);
+        this->fd = -1;
+    }
+    // A previous daemon might have left a snapshot with a bigger payload
+    // behind. It no longer holds the lock, so it can be safely truncated.
+    if (ftruncate(this->fd, 0) == -1 || !reserve(0)) {
+        int saved_errno = errno;
+        close_snapshot();
+        throw std::runtime_error("Couldn't set up menu snapshot '" +
+                                 this->path + "': " + strerror(saved_errno));
+    }
+
+    Header *header = reinterpret_cast<Header *>(this->mapping);
+    std::memcpy(header->magic, snapshot_magic, sizeof snapshot_magic);
+    header->version = snapshot_version;
+    header->header_size = sizeof(Header);
+    header->fingerprint = this->fingerprint;
+    header->generation = 0;
+    header->payload_size = 0;
+    header->pid = this->owner;
+    // Readers ignore snapshots with odd sequence. Generation 0 is empty, so
+    // the sequence stays odd until the first publish().
+    __atomic_store_n(&header->sequence, 1, __ATOMIC_RELEASE);
+}
+
+Publisher::~Publisher() {
+    close_snapshot();
+}
+
+Publisher::Publisher(Publisher &&other)
+    : path(std::move(other.path)), fingerprint(other.fingerprint),
+      fd(other.fd), mapping(other.mapping), mapping_size(other.mapping_size),
+      owner(other.owner) {
+    other.fd = -1;
+    other.mapping = nullptr;
+    other.mapping_size = 0;
+}
+
+Publisher &Publisher::operator=(Publisher &&other) {
+    if (this != &other) {
+        close_snapshot();
+        this->path = std::move(other.path);
+        this->fingerprint = other.fingerprint;
+        this->fd = other.fd;
+        this->mapping = other.mapping;
+        this->mapping_size = other.mapping_size;
+        this->owner = other.owner;
+        other.fd = -1;
+        other.mapping = nullptr;
+        other.mapping_size = 0;
+    }
+    return *this;
+}
+
+void Publisher::close_snapshot() {
+    if (this->mapping != nullptr)
+        munmap(this->mapping, this->mapping_size);
+    if (this->fd != -1) {
+        // The file must be unlinked while the lock is still held, otherwise
+        // it could remove a snapshot of another daemon.
+        if (getpid() == this->owner)
+            unlink(this->path.c_str());
+        close(this->fd);
+    }
+    this->mapping = nullptr;
+    this->mapping_size = 0;
+    this->fd = -1;
+}
+
+// Make sure that the mapping can hold a payload of payload_size bytes. The
+// file is only ever enlarged.
+bool Publisher::reserve(size_t payload_size) {
+    size_t needed = sizeof(Header) + payload_size;
+    if (this->mapping != nullptr && needed <= this->mapping_size)
+        return true;
+
+    size_t new_size = this->mapping_size == 0 ? 16384 : this->mapping_size;
+    while (new_size < needed)
+        new_size *= 2;
+
+    if (ftruncate(this->fd, new_size) == -1)
+        return false;
+    void *new_mapping = mmap(NULL, new_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, this->fd, 0);
+    if (new_mapping == MAP_FAILED)
+        return false;
+    if (this->mapping != nullptr)
+        munmap(this->mapping, this->mapping_size);
+    this->mapping = static_cast<char *>(new_mapping);
+    this->mapping_size = new_size;
+    return true;
+}
+
+void Publisher::publish(const std::vector<PublishedEntry> &entries) {
+    if (this->fd == -1)
+        return;
+
+    PayloadWriter writer;
+    writer.put_u32(entries.size());
+    for (const PublishedEntry &entry : entries) {
+        const Application &app = *entry.app;
+        writer.put_string(entry.formatted_name);
+        writer.put_bool(entry.is_generic);
+        writer.put_string(app.name);
+        writer.put_string(app.generic_name);
+        writer.put_string(app.exec);
+        writer.put_string(app.path);
+        writer.put_string(app.location);
+        writer.put_bool(app.terminal);
+    }
+    const std::string &payload = writer.get();
+
+    if (!reserve(payload.size())) {
+        SPDLOG_WARN("Couldn't enlarge menu snapshot '{}': {}. Menu snapshot "
+                    "will no longer be updated.",
+                    this->path, strerror(errno));
+        close_snapshot();
+        return;
+    }
+
+    Header *header = reinterpret_cast<Header *>(this->mapping);
+    uint64_t sequence = header->sequence;
+    // Make the sequence odd (it might be already odd if this is the first
+    // publish).
+    if (sequence % 2 == 0)
+        __atomic_store_n(&header->sequence, ++sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    std::memcpy(this->mapping + sizeof(Header), payload.data(),
+                payload.size());
+    header->payload_size = payload.size();
+    ++header->generation;
+
+    __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELEASE);
+
+    SPDLOG_DEBUG("Published menu snapshot generation {} ({} entries, {} "
+                 "bytes) to '{}'.",
+                 header->generation, entries.size(), payload.size(),
+                 this->path);
+}
+
+const std::string &Publisher::get_path() const {
+    return this->path;
+}
+
+std::optional<std::vector<Entry>> read(const std::string &path,
+                                       uint64_t fingerprint) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            SPDLOG_WARN("Couldn't open menu snapshot '{}': {}", path,
+                        strerror(errno));
+        return {};
+    }
+    OnExit close_fd = [fd]() { close(fd); };
+
+    void *mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+    OnExit unmap = [&mapping, &mapping_size]() {
+        if (mapping != MAP_FAILED)
+            munmap(mapping, mapping_size);
+    };
+
+    std::string payload;
+    uint64_t generation;
+    int attempt;
+    for (attempt = 0; attempt < max_read_attempts; ++attempt) {
+        struct stat info;
+        if (fstat(fd, &info) == -1)
+            return {};
+        if ((size_t)info.st_size < sizeof(Header))
+            return {};
+        // The daemon might have enlarged the file since the last attempt.
+        if ((size_t)info.st_size != mapping_size) {
+            if (mapping != MAP_FAILED)
+                munmap(mapping, mapping_size);
+            mapping_size = info.st_size;
+            mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED)
+                return {};
+        }
+
+        const Header *header = static_cast<const Header *>(mapping);
+        if (memcmp(header->magic, snapshot_magic, sizeof snapshot_magic) !=
+                0 ||
+            header->version != snapshot_version ||
+            header->header_size != sizeof(Header) ||
+            header->fingerprint != fingerprint) {
+            SPDLOG_DEBUG("Menu snapshot '{}' is incompatible.", path);
+            return {};
+        }
+        if (!is_process_alive(header->pid)) {
+            SPDLOG_DEBUG("Menu snapshot '{}' is stale, its daemon (PID {}) "
+                         "isn't running.",
+                         path, header->pid);
+            return {};
+        }
+
+        uint64_t sequence = load_sequence(header);
+        if (sequence % 2 == 1) {
+            // Either a write is in progress or nothing has been published
+            // yet.
+            if (header->generation == 0)
+                return {};
+            continue;
+        }
+        uint64_t payload_size = header->payload_size;
+        generation = header->generation;
+        if (payload_size > mapping_size - sizeof(Header))
+            continue;
+        payload.assign(static_cast<const char *>(mapping) + sizeof(Header),
+                       payload_size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (load_sequence(header) == sequence)
+            break;
+    }
+    if (attempt == max_read_attempts) {
+        SPDLOG_WARN("Couldn't get a consistent view of menu snapshot '{}'.",
+                    path);
+        return {};
+    }
+
+    std::vector<Entry> result;
+    try {
+        PayloadReader reader(payload);
+        uint32_t count = reader.get_u32();
+        result.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            std::string formatted_name = reader.get_string();
+            bool is_generic = reader.get_bool();
+            std::string name = reader.get_string();
+            std::string generic_name = reader.get_string();
+            std::string exec = reader.get_string();
+            std::string app_path = reader.get_string();
+            std::string location = reader.get_string();
+            bool terminal = reader.get_bool();
+            result.emplace_back(
+                std::move(formatted_name), is_generic,
+                Application(std::move(name), std::move(generic_name),
+                            std::move(exec), std::move(app_path),
+                            std::move(location), terminal));
+        }
+    } catch (const std::runtime_error &e) {
+        SPDLOG_WARN("Menu snapshot '{}' is malformed: {}", path, e.what());
+        return {};
+    }
+
+    SPDLOG_INFO("Loaded menu snapshot generation {} ({} entries) from '{}'.",
+                generation, result.size(), path);
+    return result;
+}
+}; // namespace MenuSnapshot
@@ -0,0 +1,118 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// A j4dd daemon (--wait-on) can publish the menu it would show to the user
+// into a snapshot file in $XDG_RUNTIME_DIR (which is a tmpfs on all sane
+// systems, so the snapshot effectively lives in shared memory). A one-shot
+// j4dd invocation with matching settings can then map the snapshot and skip
+// desktop file collection, AppManager construction and name formatting
+// altogether.
+//
+// The snapshot file consists of a fixed size header followed by a payload.
+// Writes are guarded by a seqlock: the daemon makes the sequence counter odd
+// before it touches the payload and even after it's done. Readers copy the
+// payload out of the mapping and retry when the counter has changed in the
+// meantime. The daemon never shrinks the file, so readers can't get SIGBUS.
+
+#ifndef MENUSNAPSHOT_DEF
+#define MENUSNAPSHOT_DEF
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+#include "Application.hh"
+#include "Utilities.hh"
+
+namespace MenuSnapshot
+{
+// Entry of a menu loaded from a snapshot.
+struct Entry
+{
+    std::string formatted_name;
+    bool is_generic;
+    Application app;
+
+    Entry(std::string formatted_name, bool is_generic, Application app);
+};
+
+// Entry of a menu which is about to be published. All members are
+// non-owning.
+struct PublishedEntry
+{
+    std::string_view formatted_name;
+    const Application *app;
+    bool is_generic;
+
+    PublishedEntry(std::string_view formatted_name, const Application *app,
+                   bool is_generic);
+};
+
+// The snapshot may only be used by j4dd invocations whose menu would look
+// exactly the same as the daemon's. All settings that influence the menu
+// should be passed to this function. The result is stored in the snapshot
+// header and it is also a part of the snapshot filename.
+uint64_t compute_fingerprint(const stringlist_t &settings);
+
+// Returns an empty string if $XDG_RUNTIME_DIR isn't set.
+std::string get_snapshot_path(uint64_t fingerprint);
+
+class Publisher
+{
+public:
+    // This throws std::runtime_error if the snapshot file couldn't be
+    // created or if it is owned by another running daemon.
+    Publisher(std::string path, uint64_t fingerprint);
+    ~Publisher();
+
+    Publisher(const Publisher &) = delete;
+    void operator=(const Publisher &) = delete;
+
+    Publisher(Publisher &&other);
+    Publisher &operator=(Publisher &&other);
+
+    // Entries must be in the order in which they should be displayed.
+    void publish(const std::vector<PublishedEntry> &entries);
+
+    const std::string &get_path() const;
+
+private:
+    bool reserve(size_t payload_size);
+    void close_snapshot();
+
+    std::string path;
+    uint64_t fingerprint;
+    int fd = -1;
+    char *mapping = nullptr;
+    size_t mapping_size = 0;
+    // The pid is stored to unlink() the file only in the process which has
+    // created it. Forked children of the daemon share this object.
+    pid_t owner;
+};
+
+// Returns an empty optional if the snapshot doesn't exist, belongs to a
+// different configuration, is malformed or if the daemon which has published
+// it is no longer running. Entries are returned in display order.
+std::optional<std::vector<Entry>> read(const std::string &path,
+                                       uint64_t fingerprint);
+}; // namespace MenuSnapshot
+
+#endif
@@ -0,0 +1,256 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "Metrics.hh"
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <charconv>
+#include <cmath>
+#include <errno.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utility>
+
+#include "Utilities.hh"
+
+void LatencyHistogram::record(std::chrono::microseconds value) {
+    uint64_t us = value.count() < 0 ? 0 : value.count();
+    std::size_t bucket = get_bucket(us);
+    if (bucket >= this->buckets.size())
+        this->buckets.resize(bucket + 1);
+    ++this->buckets[bucket];
+    ++this->total_count;
+    this->sum += us;
+    if (us > this->max_value)
+        this->max_value = us;
+}
+
+uint64_t LatencyHistogram::count() const {
+    return this->total_count;
+}
+
+std::chrono::microseconds LatencyHistogram::max() const {
+    return std::chrono::microseconds(this->max_value);
+}
+
+std::chrono::microseconds LatencyHistogram::mean() const {
+    if (this->total_count == 0)
+        return {};
+    return std::chrono::microseconds(this->sum / this->total_count);
+}
+
+std::chrono::microseconds
+LatencyHistogram::percentile(double percentile) const {
+    if (this->total_count == 0)
+        return {};
+    uint64_t rank = std::ceil(percentile / 100 * this->total_count);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < this->buckets.size(); ++i) {
+        seen += this->buckets[i];
+        if (seen >= rank)
+            return std::chrono::microseconds(
+                std::min(get_bucket_upper_bound(i), this->max_value));
+    }
+    return std::chrono::microseconds(this->max_value);
+}
+
+const std::vector<uint64_t> &LatencyHistogram::view_buckets() const {
+    return this->buckets;
+}
+
+uint64_t LatencyHistogram::get_sum() const {
+    return this->sum;
+}
+
+void LatencyHistogram::restore(std::vector<uint64_t> buckets, uint64_t sum,
+                               uint64_t max) {
+    this->buckets = std::move(buckets);
+    this->total_count = 0;
+    for (uint64_t count : this->buckets)
+        this->total_count += count;
+    this->sum = sum;
+    this->max_value = max;
+}
+
+// Values smaller than sub_bucket_count have a bucket of their own. Every
+// following power of two is split into sub_bucket_count buckets.
+std::size_t LatencyHistogram::get_bucket(uint64_t value) {
+    if (value < sub_bucket_count)
+        return value;
+    unsigned magnitude = 0;
+    while ((value >> magnitude) >= 2 * sub_bucket_count)
+        ++magnitude;
+    return sub_bucket_count * (magnitude + 1) +
+           ((value >> magnitude) - sub_bucket_count);
+}
+
+uint64_t LatencyHistogram::get_bucket_upper_bound(std::size_t bucket) {
+    if (bucket < sub_bucket_count)
+        return bucket;
+    unsigned magnitude = bucket / sub_bucket_count - 1;
+    uint64_t lower = (uint64_t)(sub_bucket_count + bucket % sub_bucket_count)
+                     << magnitude;
+    return lower + ((uint64_t)1 << magnitude) - 1;
+}
+
+static double to_ms(std::chrono::microseconds value) {
+    return value.count() / 1000.0;
+}
+
+std::string DaemonMetrics::to_json() const {
+    std::string result = fmt::format(
+        "{{\"triggers\":{},\"notify_events\":{},\"reloads\":{},\"stages\":{{",
+        this->triggers, this->notify_events, this->reloads);
+    for (std::size_t i = 0; i < stage_count; ++i) {
+        const LatencyHistogram &hist = this->stages[i];
+        result += fmt::format(
+            "{}\"{}\":{{\"count\":{},\"mean_us\":{},\"p50_us\":{},"
+            "\"p90_us\":{},\"p99_us\":{},\"max_us\":{},\"sum_us\":{},"
+            "\"buckets\":[",
+            (i == 0 ? "" : ","), stage_names[i], hist.count(),
+            hist.mean().count(), hist.percentile(50).count(),
+            hist.percentile(90).count(), hist.percentile(99).count(),
+            hist.max().count(), hist.get_sum());
+        const std::vector<uint64_t> &buckets = hist.view_buckets();
+        for (std::size_t j = 0; j < buckets.size(); ++j)
+            result += fmt::format("{}{}", (j == 0 ? "" : ","), buckets[j]);
+        result += "]}";
+    }
+    result += "}}\n";
+    return result;
+}
+
+std::string DaemonMetrics::to_text() const {
+    std::string result = fmt::format(
+        "Daemon metrics: {} triggers, {} notify events, {} reloads\n"
+        "  {:<10}{:>8}{:>12}{:>12}{:>12}{:>12}{:>12}\n",
+        this->triggers, this->notify_events, this->reloads, "stage (ms)",
+        "count", "mean", "p50", "p90", "p99", "max");
+    for (std::size_t i = 0; i < stage_count; ++i) {
+        const LatencyHistogram &hist = this->stages[i];
+        result += fmt::format(
+            "  {:<10}{:>8}{:>12.3f}{:>12.3f}{:>12.3f}{:>12.3f}{:>12.3f}\n",
+            stage_names[i], hist.count(), to_ms(hist.mean()),
+            to_ms(hist.percentile(50)), to_ms(hist.percentile(90)),
+            to_ms(hist.percentile(99)), to_ms(hist.max()));
+    }
+    return result;
+}
+
+// Find "key": after pos and parse the number following it. pos is moved after
+// the number.
+static bool parse_json_field(std::string_view json, std::string_view key,
+                             std::size_t &pos, uint64_t &result) {
+    std::string needle = fmt::format("\"{}\":", key);
+    std::size_t found = json.find(needle, pos);
+    if (found == std::string_view::npos)
+        return false;
+    const char *begin = json.data() + found + needle.size();
+    auto [end, error] = std::from_chars(begin, json.data() + json.size(),
+                                        result);
+    if (error != std::errc())
+        return false;
+    pos = end - json.data();
+    return true;
+}
+
+bool DaemonMetrics::load_json(std::string_view json) {
+    DaemonMetrics loaded;
+    std::size_t pos = 0;
+    if (!parse_json_field(json, "triggers", pos, loaded.triggers) ||
+        !parse_json_field(json, "notify_events", pos, loaded.notify_events) ||
+        !parse_json_field(json, "reloads", pos, loaded.reloads))
+        return false;
+    for (std::size_t i = 0; i < stage_count; ++i) {
+        std::size_t stage_pos =
+            json.find(fmt::format("\"{}\":{{", stage_names[i]), pos);
+        if (stage_pos == std::string_view::npos)
+            return false;
+        pos = stage_pos;
+        uint64_t max, sum;
+        if (!parse_json_field(json, "max_us", pos, max) ||
+            !parse_json_field(json, "sum_us", pos, sum))
+            return false;
+        std::size_t list_pos = json.find("\"buckets\":[", pos);
+        if (list_pos == std::string_view::npos)
+            return false;
+        pos = list_pos + 11;
+        std::vector<uint64_t> buckets;
+        while (pos < json.size() && json[pos] != ']') {
+            uint64_t count;
+            auto [end, error] = std::from_chars(
+                json.data() + pos, json.data() + json.size(), count);
+            if (error != std::errc())
+                return false;
+            buckets.push_back(count);
+            pos = end - json.data();
+            if (pos < json.size() && json[pos] == ',')
+                ++pos;
+        }
+        if (pos >= json.size())
+            return false;
+        loaded.stages[i].restore(std::move(buckets), sum, max);
+    }
+    *this = std::move(loaded);
+    return true;
+}
+
+void DaemonMetrics::save(const std::string &path) const {
+    std::string json = to_json();
+    std::string tmp_path = path + ".tmp";
+    FILE *f = fopen(tmp_path.c_str(), "w");
+    if (f == NULL) {
+        SPDLOG_ERROR("Couldn't open metrics file '{}': {}", tmp_path,
+                     strerror(errno));
+        return;
+    }
+    bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) == -1) {
+        SPDLOG_ERROR("Couldn't write metrics file '{}': {}", path,
+                     strerror(errno));
+        unlink(tmp_path.c_str());
+    }
+}
+
+void DaemonMetrics::load(const std::string &path) {
+    std::unique_ptr<FILE, fclose_deleter> f(fopen(path.c_str(), "r"));
+    if (!f) {
+        if (errno != ENOENT)
+            SPDLOG_WARN("Couldn't open metrics file '{}': {}", path,
+                        strerror(errno));
+        return;
+    }
+    std::string json;
+    char buf[4096];
+    size_t size;
+    while ((size = fread(buf, 1, sizeof buf, f.get())) > 0)
+        json.append(buf, size);
+    if (ferror(f.get())) {
+        SPDLOG_WARN("Couldn't read metrics file '{}': {}", path,
+                    strerror(errno));
+        return;
+    }
+    if (!load_json(json))
+        SPDLOG_WARN("Metrics file '{}' is malformed, ignoring it.", path);
+}
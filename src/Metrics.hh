@@ -0,0 +1,107 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Latency metrics of the --wait-on daemon. Every invocation of the menu is
+// split into stages, the duration of each stage is recorded into a histogram.
+// The histograms can be written to a file (--metrics-file) and loaded from it
+// again, so that they survive restarts of the daemon.
+
+#ifndef METRICS_DEF
+#define METRICS_DEF
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// This is a simplified HDR histogram. Values are sorted into buckets whose
+// width is proportional to their magnitude, the relative error of reported
+// values is at most 1/sub_bucket_count. Values are in microseconds.
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned sub_bucket_count = 16;
+
+    void record(std::chrono::microseconds value);
+
+    uint64_t count() const;
+    std::chrono::microseconds max() const;
+    std::chrono::microseconds mean() const;
+    // Returns the highest value which is equivalent to the value at percentile
+    // (0-100). 0 is returned if the histogram is empty.
+    std::chrono::microseconds percentile(double percentile) const;
+
+    // These are used to save and load the histogram.
+    const std::vector<uint64_t> &view_buckets() const;
+    uint64_t get_sum() const;
+    void restore(std::vector<uint64_t> buckets, uint64_t sum, uint64_t max);
+
+    static std::size_t get_bucket(uint64_t value);
+    // Returns the highest value which falls into bucket.
+    static uint64_t get_bucket_upper_bound(std::size_t bucket);
+
+private:
+    std::vector<uint64_t> buckets;
+    uint64_t total_count = 0;
+    uint64_t sum = 0;
+    uint64_t max_value = 0;
+};
+
+struct DaemonMetrics
+{
+    // Stages of a menu invocation. Their durations are measured from the
+    // end of the previous stage.
+    enum stage {
+        // The FIFO has been written to, dmenu has been spawned.
+        spawn,
+        // The menu has been written to dmenu.
+        write,
+        // The user has selected an entry.
+        selection,
+        // The selected command has been exec()ed or i3 has acknowledged it.
+        launch,
+        stage_count
+    };
+
+    static constexpr std::array<const char *, stage_count> stage_names = {
+        "spawn", "write", "selection", "launch"};
+
+    std::array<LatencyHistogram, stage_count> stages;
+    // The number of FIFO triggers which have shown a menu.
+    uint64_t triggers = 0;
+    // The number of changes reported by notifiers.
+    uint64_t notify_events = 0;
+    // The number of times changes of desktop files have been applied.
+    uint64_t reloads = 0;
+
+    std::string to_json() const;
+    std::string to_text() const;
+    // Load metrics saved by to_json(). Returns false if json couldn't be
+    // parsed, the metrics are left unchanged in that case.
+    bool load_json(std::string_view json);
+
+    // Write the metrics to path as JSON. Errors are logged.
+    void save(const std::string &path) const;
+    // Load metrics saved by save(). A missing file isn't an error, other
+    // errors are logged and the metrics are left unchanged.
+    void load(const std::string &path);
+};
+
+#endif
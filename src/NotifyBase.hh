@@ -18,6 +18,7 @@
 #ifndef NOTIFYBASE_DEF
 #define NOTIFYBASE_DEF
 
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -32,7 +33,10 @@ public:
 
     // AppManager doesn't see a difference between created and modified desktop
     // files so only a single flag is used for them.
-    enum changetype { modified, deleted };
+    // rescan means that changes of the rank could have been lost. All its
+    // files must be compared with the desktop files known to AppManager. name
+    // is empty in this case.
+    enum changetype { modified, deleted, rescan };
 
     struct FileChange
     {
@@ -47,5 +51,15 @@ public:
     // FileChange has absolute paths (they are relative to search_path
     // specified in ctor; search_path is absolute so this must be too).
     virtual std::vector<FileChange> getchanges() = 0;
+
+    // Notifiers which traverse the search path while they set up watching
+    // can return the files they have found (in absolute paths), so that the
+    // search path doesn't have to be traversed twice. An empty optional is
+    // returned if the rank isn't watched by the notifier or if it doesn't
+    // keep a list of files.
+    virtual std::optional<std::vector<std::string>>
+    list_files(int /* rank */) const {
+        return std::nullopt;
+    }
 };
 #endif
@@ -17,9 +17,17 @@
 
 #include "NotifyInotify.hh"
 
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
 #include <errno.h>
+#include <stdexcept>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
 #include <sys/inotify.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utility>
@@ -29,7 +37,24 @@
 NotifyInotify::directory_entry::directory_entry(int r, std::string p)
     : rank(r), path(std::move(p)) {}
 
-NotifyInotify::NotifyInotify(const stringlist_t &search_path) {
+// Directories are watched for creation of subdirectories too. Files are
+// reported when they are closed after writing (not after every write()), so
+// files which are being written aren't read prematurely.
+static constexpr uint32_t inotify_watch_mask =
+    IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVE;
+// Roots of the search path are watched for their own removal.
+static constexpr uint32_t inotify_root_mask =
+    inotify_watch_mask | IN_DELETE_SELF | IN_MOVE_SELF;
+// Ancestors of missing roots of the search path are watched for creation of
+// their subdirectories. IN_MASK_ADD is used, because the ancestor can be
+// watched for other reasons too.
+static constexpr uint32_t inotify_ancestor_mask = IN_CREATE | IN_MOVED_TO |
+                                                  IN_DELETE_SELF |
+                                                  IN_MOVE_SELF | IN_MASK_ADD;
+
+NotifyInotify::NotifyInotify(const stringlist_t &search_path,
+                             std::set<int> skipped_ranks)
+    : search_path(search_path), skipped_ranks(std::move(skipped_ranks)) {
     inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
     if (inotifyfd == -1)
         PFATALE("inotify_init");
@@ -38,26 +63,178 @@ NotifyInotify::NotifyInotify(const stringlist_t &search_path) {
          i++) // size() is converted to int to silent warnings about
               // narrowing when adding i to directories
     {
-        int wd = inotify_add_watch(inotifyfd, search_path[i].c_str(),
-                                   IN_DELETE | IN_MODIFY | IN_MOVE);
-        if (wd == -1)
+        if (this->skipped_ranks.count(i) != 0)
+            continue;
+        if (!watch_root(i, nullptr))
             PFATALE("inotify_add_watch");
-        directories.insert({
-            wd, {i, {}}
-        });
-        FileFinder find(search_path[i]);
+    }
+}
+
+bool NotifyInotify::watch_subtree(int rank, const std::string &path,
+                                  std::vector<FileChange> *changes) {
+    const std::string &base = this->search_path[rank];
+    std::string full_path = base + path;
+
+    int wd = inotify_add_watch(
+        inotifyfd, full_path.c_str(),
+        (path.empty() ? inotify_root_mask : inotify_watch_mask));
+    if (wd == -1)
+        return false;
+    // Directories of this subtree by their absolute path (with trailing
+    // slash). Pointers to elements of unordered_map stay valid.
+    std::unordered_map<std::string, directory_entry *> subtree;
+    subtree[full_path] =
+        &directories.insert_or_assign(wd, directory_entry(rank, path))
+             .first->second;
+
+    // The watch is added before the directory is read, so files created in
+    // the meantime are reported either here or by inotify (or both).
+    try {
+        FileFinder find(full_path);
         while (++find) {
-            if (!find.isdir())
+            const std::string &found = find.path();
+            if (find.isdir()) {
+                wd = inotify_add_watch(inotifyfd, found.c_str(),
+                                       inotify_watch_mask);
+                if (wd == -1)
+                    continue;
+                subtree[found + '/'] =
+                    &directories
+                         .insert_or_assign(
+                             wd, directory_entry(
+                                     rank, found.substr(base.length()) + '/'))
+                         .first->second;
+                continue;
+            }
+            auto slash = found.rfind('/');
+            auto dir = subtree.find(found.substr(0, slash + 1));
+            if (dir == subtree.end())
                 continue;
-            wd = inotify_add_watch(inotifyfd, find.path().c_str(),
-                                   IN_DELETE | IN_MODIFY);
-            directories.insert({
-                wd, {i, find.path().substr(search_path[i].length()) + '/'}
-            });
+            dir->second->files.insert(found.substr(slash + 1));
+            if (changes != nullptr)
+                changes->emplace_back(rank, found.substr(base.length()),
+                                      changetype::modified);
+        }
+    } catch (const std::runtime_error &e) {
+        // The directory can be removed before it is read.
+        SPDLOG_WARN("Couldn't read directory '{}': {}", full_path, e.what());
+    }
+    return true;
+}
+
+void NotifyInotify::unwatch_subtree(int rank, const std::string &path,
+                                    std::vector<FileChange> *changes) {
+    for (auto iter = directories.begin(); iter != directories.end();) {
+        const directory_entry &dir = iter->second;
+        if (dir.rank != rank || !startswith(dir.path, path)) {
+            ++iter;
+            continue;
+        }
+        if (changes != nullptr) {
+            for (const std::string &file : dir.files)
+                changes->emplace_back(rank, dir.path + file,
+                                      changetype::deleted);
+        }
+        // This fails if the directory has been deleted, the kernel removes
+        // the watch itself in that case.
+        if (missing_roots.count(iter->first) == 0)
+            inotify_rm_watch(inotifyfd, iter->first);
+        iter = directories.erase(iter);
+    }
+}
+
+bool NotifyInotify::watch_root(int rank, std::vector<FileChange> *changes) {
+    const std::string &root = this->search_path[rank];
+    // The deepest ancestor is tried first.
+    std::string path = root;
+    while (true) {
+        if (path.length() == root.length()) {
+            if (watch_subtree(rank, {}, changes))
+                return true;
+        } else {
+            int wd = inotify_add_watch(inotifyfd, path.c_str(),
+                                       inotify_ancestor_mask);
+            if (wd != -1) {
+                // The next directory could have been created before the
+                // watch was added. Start over in that case.
+                if (is_directory(root.substr(0, root.find('/', path.size())))) {
+                    remove_unused_watch(wd);
+                    path = root;
+                    continue;
+                }
+                missing_roots[wd].push_back(rank);
+                SPDLOG_DEBUG("Directory '{}' doesn't exist, watching '{}' "
+                             "for its creation.",
+                             root, path);
+                return true;
+            }
         }
+        if ((errno != ENOENT && errno != ENOTDIR) || path == "/")
+            return false;
+        path.pop_back(); // remove the trailing slash
+        path.erase(path.rfind('/') + 1);
     }
 }
 
+void NotifyInotify::retry_missing_roots(int wd,
+                                        std::vector<FileChange> &changes) {
+    auto iter = missing_roots.find(wd);
+    if (iter == missing_roots.end())
+        return;
+    std::vector<int> ranks = std::move(iter->second);
+    missing_roots.erase(iter);
+    for (int rank : ranks) {
+        if (!watch_root(rank, &changes))
+            SPDLOG_WARN("Couldn't watch directory '{}': {}",
+                        this->search_path[rank], strerror(errno));
+    }
+    remove_unused_watch(wd);
+}
+
+void NotifyInotify::remove_unused_watch(int wd) {
+    if (directories.count(wd) == 0 && missing_roots.count(wd) == 0)
+        inotify_rm_watch(inotifyfd, wd);
+}
+
+void NotifyInotify::rewatch_rank(int rank, std::vector<FileChange> &changes) {
+    SPDLOG_INFO("Events of directory '{}' could have been lost, rescanning it.",
+                this->search_path[rank]);
+    unwatch_subtree(rank, {}, nullptr);
+    for (auto iter = missing_roots.begin(); iter != missing_roots.end();) {
+        std::vector<int> &ranks = iter->second;
+        ranks.erase(std::remove(ranks.begin(), ranks.end(), rank),
+                    ranks.end());
+        if (!ranks.empty()) {
+            ++iter;
+            continue;
+        }
+        int wd = iter->first;
+        iter = missing_roots.erase(iter);
+        remove_unused_watch(wd);
+    }
+    if (!watch_root(rank, nullptr))
+        SPDLOG_WARN("Couldn't watch directory '{}': {}",
+                    this->search_path[rank], strerror(errno));
+    changes.emplace_back(rank, std::string(), changetype::rescan);
+}
+
+std::optional<std::vector<std::string>>
+NotifyInotify::list_files(int rank) const {
+    if (this->skipped_ranks.count(rank) != 0)
+        return std::nullopt;
+    std::vector<std::string> result;
+    const std::string &base = this->search_path[rank];
+    for (const auto &[wd, dir] : this->directories) {
+        if (dir.rank != rank)
+            continue;
+        for (const std::string &file : dir.files)
+            result.push_back(base + dir.path + file);
+    }
+    // Make the order independent of watch descriptors.
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
 int NotifyInotify::getfd() const {
     return inotifyfd;
 }
@@ -73,14 +250,107 @@ std::vector<NotifyInotify::FileChange> NotifyInotify::getchanges() {
              ptr += sizeof(inotify_event) + event->len) {
             event = reinterpret_cast<const inotify_event *>(ptr);
 
-            const auto &dir = directories.at(event->wd);
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Any event could have been lost, everything must be checked.
+                SPDLOG_WARN("Inotify event queue has overflowed!");
+                for (int rank = 0; rank < (int)search_path.size(); ++rank) {
+                    if (skipped_ranks.count(rank) == 0)
+                        rewatch_rank(rank, result);
+                }
+                continue;
+            }
 
-            if (event->mask & IN_MODIFY || event->mask & IN_MOVED_TO)
+            // Any change of an ancestor of a missing root could mean that
+            // the root has been created. This is checked before directories
+            // are looked at, because the ancestor can be watched for both.
+            retry_missing_roots(event->wd, result);
+
+            // Events of removed watches can still be queued.
+            auto dir_iter = directories.find(event->wd);
+            if (dir_iter == directories.end())
+                continue;
+            directory_entry &dir = dir_iter->second;
+
+            if (event->mask & IN_UNMOUNT) {
+                // The filesystem containing the directory has been unmounted.
+                // The directory may still exist (it may be a mount point) but
+                // its contents have changed without any events.
+                rewatch_rank(dir.rank, result);
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The watch has been removed by the kernel, because the
+                // directory has been deleted. Its parent directory reports
+                // that too, but the order of these events isn't guaranteed.
+                int rank = dir.rank;
+                if (dir.path.empty()) {
+                    // Roots are normally handled by IN_DELETE_SELF.
+                    unwatch_subtree(rank, {}, &result);
+                    if (!watch_root(rank, &result))
+                        SPDLOG_WARN("Couldn't watch directory '{}': {}",
+                                    search_path[rank], strerror(errno));
+                    continue;
+                }
+                for (const std::string &file : dir.files)
+                    result.emplace_back(rank, dir.path + file,
+                                        changetype::deleted);
+                directories.erase(dir_iter);
+                continue;
+            }
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // Subdirectories are handled by events of their parent
+                // directory, they can get these events only if they are
+                // ancestors of a missing root too.
+                if (!dir.path.empty())
+                    continue;
+                // Wait for the root to be created again.
+                int rank = dir.rank;
+                unwatch_subtree(rank, {}, &result);
+                if (!watch_root(rank, &result))
+                    SPDLOG_WARN("Couldn't watch directory '{}': {}",
+                                search_path[rank], strerror(errno));
+                continue;
+            }
+
+            if (event->mask & IN_ISDIR) {
+                // watch_subtree() and unwatch_subtree() modify directories,
+                // dir can't be used after them.
+                int rank = dir.rank;
+                std::string path = dir.path + event->name + '/';
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (!watch_subtree(rank, path, &result))
+                        SPDLOG_WARN("Couldn't watch directory '{}': {}",
+                                    search_path[rank] + path, strerror(errno));
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    unwatch_subtree(rank, path, &result);
+                continue;
+            }
+
+            if (event->mask & IN_CREATE) {
+                // Regular files are reported when they are written to.
+                // Symlinks and hard links (ln, cp -l) are created without
+                // being written to, they generate only IN_CREATE.
+                std::string full_path =
+                    search_path[dir.rank] + dir.path + event->name;
+                struct stat st;
+                if (fstatat(AT_FDCWD, full_path.c_str(), &st,
+                            AT_SYMLINK_NOFOLLOW) == -1)
+                    continue;
+                if (S_ISREG(st.st_mode) && st.st_nlink == 1)
+                    continue;
+                dir.files.insert(event->name);
+                result.push_back(
+                    {dir.rank, dir.path + event->name, changetype::modified});
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                dir.files.insert(event->name);
                 result.push_back(
                     {dir.rank, dir.path + event->name, changetype::modified});
-            else // IN_DELETE or IN_MOVED_FROM
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                dir.files.erase(event->name);
                 result.push_back(
                     {dir.rank, dir.path + event->name, changetype::deleted});
+            }
         }
     }
 
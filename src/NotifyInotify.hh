@@ -18,6 +18,8 @@
 #ifndef NOTIFYINOTIFY_DEV
 #define NOTIFYINOTIFY_DEV
 
+#include <optional>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -35,19 +37,54 @@ private:
         int rank;
         std::string path; // this is the intermediate path for subdirectories in
                           // searchpath directory
+        // Names of files in the directory. They are needed to report deletion
+        // of files when the directory is moved away.
+        std::set<std::string> files;
 
         directory_entry(int r, std::string p);
     };
 
     std::unordered_map<int /* watch descriptor */, directory_entry> directories;
+    stringlist_t search_path;
+    // Ranks which are handled by a different notifier.
+    std::set<int> skipped_ranks;
+
+    // Watch directory path (relative to search_path[rank], it must be empty or
+    // end with a slash) and all its subdirectories. If changes isn't nullptr,
+    // files found in them are reported as modified. Returns false if path
+    // couldn't be watched.
+    bool watch_subtree(int rank, const std::string &path,
+                       std::vector<FileChange> *changes);
+    // Stop watching directory path and its subdirectories. If changes isn't
+    // nullptr, their files are reported as deleted.
+    void unwatch_subtree(int rank, const std::string &path,
+                         std::vector<FileChange> *changes);
+
+    // Roots of the search path which don't exist yet by the watch descriptor
+    // of their nearest existing ancestor.
+    std::unordered_map<int /* watch descriptor */, std::vector<int /* rank */>>
+        missing_roots;
+
+    // Watch search_path[rank] or its nearest existing ancestor if it doesn't
+    // exist. Files of the root are reported in changes if it isn't nullptr.
+    // Returns false on failure.
+    bool watch_root(int rank, std::vector<FileChange> *changes);
+    // Call watch_root() for all missing roots which wait on wd.
+    void retry_missing_roots(int wd, std::vector<FileChange> &changes);
+    void remove_unused_watch(int wd);
+    // Drop all watches of rank and watch it again from scratch. This is done
+    // when events could have been lost. The rank is reported for rescan.
+    void rewatch_rank(int rank, std::vector<FileChange> &changes);
 
 public:
-    NotifyInotify(const stringlist_t &search_path);
+    NotifyInotify(const stringlist_t &search_path,
+                  std::set<int> skipped_ranks = {});
 
     NotifyInotify(const NotifyInotify &) = delete;
     void operator=(const NotifyInotify &) = delete;
 
     int getfd() const;
     std::vector<FileChange> getchanges();
+    std::optional<std::vector<std::string>> list_files(int rank) const;
 };
 #endif
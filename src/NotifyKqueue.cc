@@ -102,7 +102,8 @@ void NotifyKqueue::process_kqueue(const stringlist_t &search_path,
     }
 }
 
-NotifyKqueue::NotifyKqueue(const stringlist_t &search_path) {
+NotifyKqueue::NotifyKqueue(const stringlist_t &search_path,
+                           const std::set<int> &skipped_ranks) {
     if (pipe2(pipefd, O_NONBLOCK | O_CLOEXEC) == -1)
         PFATALE("pipe");
 
@@ -116,6 +117,10 @@ NotifyKqueue::NotifyKqueue(const stringlist_t &search_path) {
          i++) // size() is converted to int to silent warnings about
               // narrowing when adding i to directories
     {
+        // Directories of the search path which don't exist aren't watched,
+        // unlike NotifyInotify, their creation isn't noticed.
+        if (skipped_ranks.count(i) != 0 || !is_directory(search_path[i]))
+            continue;
         std::stack<std::string, std::vector<std::string>> dirstack;
         dirstack.push(search_path[i]);
 
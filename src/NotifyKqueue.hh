@@ -34,6 +34,8 @@ using stringlist_t = std::vector<std::string>;
  * descriptors and desktop files aren't really modified often. The most typical
  * desktop file modifications are their creation on package install and their
  * removal on package uninstallation.
+ * Directories of the search path which don't exist at startup aren't watched
+ * either, NotifyInotify watches their nearest existing ancestor instead.
  */
 
 class NotifyKqueue final : public NotifyBase
@@ -63,7 +65,9 @@ private:
                                NotifyKqueue &instance);
 
 public:
-    NotifyKqueue(const stringlist_t &search_path);
+    // Ranks in skipped_ranks aren't watched.
+    NotifyKqueue(const stringlist_t &search_path,
+                 const std::set<int> &skipped_ranks = {});
     int getfd() const;
     std::vector<FileChange> getchanges();
 };
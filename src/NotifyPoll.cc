@@ -0,0 +1,309 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "NotifyPoll.hh"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iterator>
+#include <string.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#else
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+
+static bool timespec_differs(const timespec &a, const timespec &b) {
+    return a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec;
+}
+
+NotifyPoll::NotifyPoll(const stringlist_t &search_path, std::vector<int> ranks,
+                       std::chrono::milliseconds interval)
+    : search_path(search_path), ranks(std::move(ranks)) {
+    if (pipe(pipefd) == -1)
+        PFATALE("pipe");
+    for (int fd : pipefd) {
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 ||
+            fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+            PFATALE("fcntl");
+    }
+
+    for (int rank : this->ranks) {
+        SPDLOG_INFO("Polling directory '{}' for changes every {} ms.",
+                    this->search_path[rank], interval.count());
+        scan_subtree(rank, {}, nullptr);
+    }
+    // The polling thread hasn't been started yet, warnings can be logged
+    // directly.
+    for (const std::string &warning : this->scan_warnings)
+        SPDLOG_WARN("{}", warning);
+    this->scan_warnings.clear();
+
+    this->poller = std::thread(&NotifyPoll::run, this, interval);
+}
+
+NotifyPoll::~NotifyPoll() {
+    {
+        std::lock_guard<std::mutex> lock(this->stop_mutex);
+        this->stop = true;
+    }
+    this->stop_cv.notify_one();
+    this->poller.join();
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
+
+int NotifyPoll::getfd() const {
+    return pipefd[0];
+}
+
+std::vector<NotifyBase::FileChange> NotifyPoll::getchanges() {
+    char data[64];
+    while (read(pipefd[0], data, sizeof data) > 0)
+        ;
+    std::vector<FileChange> result;
+    std::vector<std::string> warnings;
+    {
+        std::lock_guard<std::mutex> lock(this->changes_mutex);
+        result.swap(this->changes);
+        warnings.swap(this->warnings);
+    }
+    for (const std::string &warning : warnings)
+        SPDLOG_WARN("{}", warning);
+    return result;
+}
+
+std::optional<std::vector<std::string>>
+NotifyPoll::list_files(int rank) const {
+    if (std::find(this->ranks.begin(), this->ranks.end(), rank) ==
+        this->ranks.end())
+        return std::nullopt;
+    std::vector<std::string> result;
+    const std::string &base = this->search_path[rank];
+    std::lock_guard<std::mutex> lock(this->directories_mutex);
+    for (auto iter = this->directories.lower_bound({rank, {}});
+         iter != this->directories.end() && iter->first.first == rank;
+         ++iter) {
+        for (const auto &file : iter->second.files)
+            result.push_back(base + iter->first.second + file.first);
+    }
+    return result;
+}
+
+bool NotifyPoll::should_poll(const std::string &path) {
+    struct statfs fs;
+    if (statfs(path.c_str(), &fs) == -1)
+        return false;
+#ifdef __linux__
+    switch ((unsigned long)fs.f_type) {
+    case 0x6969:     // NFS_SUPER_MAGIC
+    case 0x65735546: // FUSE_SUPER_MAGIC
+    case 0x517B:     // SMB_SUPER_MAGIC
+    case 0xFF534D42: // CIFS_SUPER_MAGIC
+    case 0xFE534D42: // SMB2_SUPER_MAGIC
+    case 0x01021997: // V9FS_MAGIC
+    case 0x00C36400: // CEPH_SUPER_MAGIC
+    case 0x5346414F: // AFS_FS_MAGIC
+        return true;
+    default:
+        return false;
+    }
+#else
+    std::string_view type = fs.f_fstypename;
+    return type == "nfs" || type == "fusefs" || type == "smbfs";
+#endif
+}
+
+void NotifyPoll::scan_subtree(int rank, const std::string &path,
+                              std::vector<FileChange> *changes) {
+    std::string full_path = this->search_path[rank] + path;
+    struct stat st;
+    if (stat(full_path.c_str(), &st) == -1 || !S_ISDIR(st.st_mode))
+        return;
+    DIR *d = opendir(full_path.c_str());
+    if (d == NULL) {
+        this->scan_warnings.push_back(fmt::format(
+            "Couldn't read directory '{}': {}", full_path, strerror(errno)));
+        return;
+    }
+
+    directory_entry &dir = this->directories[{rank, path}];
+    dir.mtime = st.st_mtim;
+
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        // Exclude ., .. and hidden files
+        if (entry->d_name[0] == '.')
+            continue;
+        if (stat((full_path + entry->d_name).c_str(), &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            dir.subdirectories.insert(entry->d_name);
+        else {
+            dir.files[entry->d_name] = {st.st_mtim, st.st_ino};
+            if (changes != nullptr)
+                changes->emplace_back(rank, path + entry->d_name,
+                                      changetype::modified);
+        }
+    }
+    closedir(d);
+
+    // dir can't be used while subdirectories are added to directories.
+    std::set<std::string> subdirectories = dir.subdirectories;
+    for (const std::string &subdirectory : subdirectories)
+        scan_subtree(rank, path + subdirectory + '/', changes);
+}
+
+void NotifyPoll::remove_subtree(int rank, const std::string &path,
+                                std::vector<FileChange> &changes) {
+    auto iter = this->directories.lower_bound({rank, path});
+    while (iter != this->directories.end() && iter->first.first == rank &&
+           startswith(iter->first.second, path)) {
+        for (const auto &file : iter->second.files)
+            changes.emplace_back(rank, iter->first.second + file.first,
+                                 changetype::deleted);
+        iter = this->directories.erase(iter);
+    }
+}
+
+void NotifyPoll::rescan_directory(int rank, const std::string &path,
+                                  std::vector<FileChange> &changes) {
+    std::string full_path = this->search_path[rank] + path;
+    struct stat st;
+    if (stat(full_path.c_str(), &st) == -1 || !S_ISDIR(st.st_mode)) {
+        remove_subtree(rank, path, changes);
+        return;
+    }
+
+    directory_entry &dir = this->directories.at({rank, path});
+    if (!timespec_differs(dir.mtime, st.st_mtim))
+        return;
+
+    DIR *d = opendir(full_path.c_str());
+    if (d == NULL) {
+        // The mtime is left as is, the directory is read again on the next
+        // poll.
+        this->scan_warnings.push_back(fmt::format(
+            "Couldn't read directory '{}': {}", full_path, strerror(errno)));
+        return;
+    }
+    dir.mtime = st.st_mtim;
+    std::map<std::string, file_state> files;
+    std::set<std::string> subdirectories;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        if (stat((full_path + entry->d_name).c_str(), &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            subdirectories.insert(entry->d_name);
+        else
+            files[entry->d_name] = {st.st_mtim, st.st_ino};
+    }
+    closedir(d);
+
+    for (const auto &[name, state] : dir.files) {
+        if (files.count(name) == 0)
+            changes.emplace_back(rank, path + name, changetype::deleted);
+    }
+    for (const auto &[name, state] : files) {
+        auto old = dir.files.find(name);
+        if (old == dir.files.end() ||
+            timespec_differs(old->second.mtime, state.mtime) ||
+            old->second.inode != state.inode)
+            changes.emplace_back(rank, path + name, changetype::modified);
+    }
+    dir.files = std::move(files);
+
+    std::set<std::string> old_subdirectories = std::move(dir.subdirectories);
+    dir.subdirectories = subdirectories;
+    // dir can't be used after this point.
+    for (const std::string &name : old_subdirectories) {
+        if (subdirectories.count(name) == 0)
+            remove_subtree(rank, path + name + '/', changes);
+    }
+    for (const std::string &name : subdirectories) {
+        if (old_subdirectories.count(name) == 0)
+            scan_subtree(rank, path + name + '/', &changes);
+    }
+}
+
+void NotifyPoll::poll_once(std::vector<FileChange> &changes) {
+    for (int rank : this->ranks) {
+        // The root doesn't exist, it could have been created since the last
+        // poll.
+        if (this->directories.count({rank, {}}) == 0)
+            scan_subtree(rank, {}, &changes);
+    }
+
+    // Directories can be added and removed while they are checked. Removed
+    // directories are skipped, new directories have just been read.
+    std::vector<std::pair<int, std::string>> keys;
+    keys.reserve(this->directories.size());
+    for (const auto &dir : this->directories)
+        keys.push_back(dir.first);
+    for (const auto &[rank, path] : keys) {
+        if (this->directories.count({rank, path}) != 0)
+            rescan_directory(rank, path, changes);
+    }
+}
+
+void NotifyPoll::run(std::chrono::milliseconds interval) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->stop_mutex);
+            if (this->stop_cv.wait_for(lock, interval,
+                                       [this] { return this->stop; }))
+                return;
+        }
+
+        std::vector<FileChange> found;
+        std::vector<std::string> found_warnings;
+        {
+            std::lock_guard<std::mutex> lock(this->directories_mutex);
+            poll_once(found);
+            found_warnings.swap(this->scan_warnings);
+        }
+        if (found.empty() && found_warnings.empty())
+            continue;
+
+        {
+            std::lock_guard<std::mutex> lock(this->changes_mutex);
+            this->changes.insert(this->changes.end(),
+                                 std::make_move_iterator(found.begin()),
+                                 std::make_move_iterator(found.end()));
+            this->warnings.insert(
+                this->warnings.end(),
+                std::make_move_iterator(found_warnings.begin()),
+                std::make_move_iterator(found_warnings.end()));
+            // This is logged the next time getchanges() is called.
+            if (write(pipefd[1], "", 1) == -1 && errno != EAGAIN)
+                this->warnings.push_back(fmt::format(
+                    "Couldn't notify about changes: {}", strerror(errno)));
+        }
+    }
+}
@@ -0,0 +1,122 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef NOTIFYPOLL_DEF
+#define NOTIFYPOLL_DEF
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <time.h>
+#include <utility>
+#include <vector>
+
+#include "NotifyBase.hh"
+#include "Utilities.hh"
+
+/*
+ * This is a portable Notify implementation which periodically stat()s
+ * directories of the search path. It is meant for network and FUSE
+ * filesystems, where inotify and kqueue don't see changes made by other
+ * hosts.
+ *
+ * Only directories are stat()ed on every poll. A directory is read again only
+ * if its mtime has changed, its files are then compared with the previous
+ * state. Desktop files which are modified in place (without being replaced)
+ * are therefore detected only if something else changes in their directory.
+ */
+
+class NotifyPoll final : public NotifyBase
+{
+private:
+    int pipefd[2];
+
+    struct file_state
+    {
+        timespec mtime;
+        ino_t inode;
+    };
+
+    struct directory_entry
+    {
+        timespec mtime;
+        std::map<std::string, file_state> files;
+        std::set<std::string> subdirectories;
+    };
+
+    // Directories by their rank and their path relative to the rank (which is
+    // empty or which ends with a slash).
+    using directories_type =
+        std::map<std::pair<int, std::string>, directory_entry>;
+
+    stringlist_t search_path;
+    std::vector<int> ranks;
+    directories_type directories;
+    // Warnings produced while reading directories. The polling thread must
+    // not log (sinks aren't thread safe), they are logged by getchanges().
+    std::vector<std::string> scan_warnings;
+    // directories and scan_warnings are accessed by the polling thread.
+    mutable std::mutex directories_mutex;
+
+    std::vector<FileChange> changes;
+    std::vector<std::string> warnings;
+    std::mutex changes_mutex;
+
+    std::thread poller;
+    bool stop = false;
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+
+    // Read directory path and all its subdirectories. Their files are
+    // reported as modified if changes isn't nullptr.
+    void scan_subtree(int rank, const std::string &path,
+                      std::vector<FileChange> *changes);
+    // Forget directory path and all its subdirectories. Their files are
+    // reported as deleted.
+    void remove_subtree(int rank, const std::string &path,
+                        std::vector<FileChange> &changes);
+    // Compare directory with its previous state.
+    void rescan_directory(int rank, const std::string &path,
+                          std::vector<FileChange> &changes);
+    void poll_once(std::vector<FileChange> &changes);
+    void run(std::chrono::milliseconds interval);
+
+public:
+    // Only roots of the search path whose rank is in ranks are watched.
+    NotifyPoll(const stringlist_t &search_path, std::vector<int> ranks,
+               std::chrono::milliseconds interval);
+    ~NotifyPoll();
+
+    NotifyPoll(const NotifyPoll &) = delete;
+    void operator=(const NotifyPoll &) = delete;
+
+    int getfd() const;
+    std::vector<FileChange> getchanges();
+    std::optional<std::vector<std::string>> list_files(int rank) const;
+
+    // Returns true if path is located on a network or FUSE filesystem, where
+    // other notification mechanisms are unreliable.
+    static bool should_poll(const std::string &path);
+};
+
+#endif
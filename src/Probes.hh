@@ -0,0 +1,117 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// USDT (SystemTap SDT) probes. They are compiled in only if J4DD_USDT is
+// defined (-Dusdt=true in Meson, -DWITH_USDT=ON in CMake). A probe is a
+// single nop instruction and an ELF note describing where its arguments are,
+// bpftrace and perf can attach to it in a running process:
+//
+//     bpftrace -e 'usdt:/usr/bin/j4-dmenu-desktop:j4dd:parse_start
+//                  { printf("%s\n", str(arg0)); }' -p <pid>
+//
+// <sys/sdt.h> is used if it's available. Otherwise J4DD_USDT_FALLBACK is
+// defined and the notes are emitted by the minimal implementation below,
+// which supports only x86-64. Arguments of probes must be integers or
+// pointers.
+//
+// Probes (provider j4dd):
+//     parse_start(path), parse_end(path), parse_disabled(path),
+//     parse_invalid(path), app_add(path, rank), app_remove(path),
+//     mapping_reload(name count), fifo_trigger(character),
+//     dmenu_spawn(pid), selection(choice), exec(command line)
+
+#ifndef PROBES_DEF
+#define PROBES_DEF
+
+#ifdef J4DD_USDT
+
+#include <stdint.h>
+#include <type_traits>
+
+#ifndef J4DD_USDT_FALLBACK
+
+#include <sys/sdt.h>
+
+#define J4DD_PROBE1(name, a) DTRACE_PROBE1(j4dd, name, a)
+#define J4DD_PROBE2(name, a, b) DTRACE_PROBE2(j4dd, name, a, b)
+
+#elif defined(__x86_64__)
+
+namespace Probes
+{
+// All arguments are passed as 64 bit signed integers.
+template <typename T> inline int64_t convert_arg(T value) {
+    if constexpr (std::is_pointer_v<T>)
+        return (int64_t)(uintptr_t)value;
+    else
+        return (int64_t)value;
+}
+}; // namespace Probes
+
+// This is the layout of the note used by <sys/sdt.h> version 3: address of
+// the probe, address of .stapsdt.base (for prelink), address of the semaphore
+// (unused), provider, name and argument descriptions.
+#define J4DD_SDT_NOTE(name, args)                                              \
+    "990: nop\n"                                                               \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                              \
+    ".balign 4\n"                                                              \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                         \
+    "991: .asciz \"stapsdt\"\n"                                                \
+    "992: .balign 4\n"                                                         \
+    "993: .8byte 990b\n"                                                       \
+    ".8byte _.stapsdt.base\n"                                                  \
+    ".8byte 0\n"                                                               \
+    ".asciz \"j4dd\"\n"                                                        \
+    ".asciz \"" #name "\"\n"                                                   \
+    ".asciz \"" args "\"\n"                                                    \
+    "994: .balign 4\n"                                                         \
+    ".popsection\n"                                                            \
+    ".ifndef _.stapsdt.base\n"                                                 \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"    \
+    ".weak _.stapsdt.base\n"                                                   \
+    ".hidden _.stapsdt.base\n"                                                 \
+    "_.stapsdt.base: .space 1\n"                                               \
+    ".size _.stapsdt.base, 1\n"                                                \
+    ".popsection\n"                                                            \
+    ".endif\n"
+
+#define J4DD_PROBE1(name, a)                                                   \
+    __asm__ __volatile__(J4DD_SDT_NOTE(name, "-8@%0")                          \
+                         :                                                     \
+                         : "nor"(Probes::convert_arg(a)))
+#define J4DD_PROBE2(name, a, b)                                                \
+    __asm__ __volatile__(J4DD_SDT_NOTE(name, "-8@%0 -8@%1")                    \
+                         :                                                     \
+                         : "nor"(Probes::convert_arg(a)),                      \
+                           "nor"(Probes::convert_arg(b)))
+
+#else
+#error "USDT probes require <sys/sdt.h> on this architecture."
+#endif
+
+#else
+
+#define J4DD_PROBE1(name, a)                                                   \
+    do {                                                                       \
+    } while (0)
+#define J4DD_PROBE2(name, a, b)                                                \
+    do {                                                                       \
+    } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "Profiler.hh"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <vector>
+
+#include "Tracer.hh"
+
+namespace Profiler
+{
+namespace
+{
+struct phase_entry
+{
+    const char *name;
+    clock::time_point start;
+    std::optional<clock::duration> duration;
+};
+
+struct state_type
+{
+    bool enabled = false;
+    output_format format = output_format::text;
+
+    std::vector<phase_entry> phases;
+    // This is incremented by report(), Phases started before it can't touch
+    // phases anymore.
+    unsigned generation = 0;
+
+    std::array<uint64_t, parse_bucket_count> parse_buckets{};
+    uint64_t parse_count = 0;
+    clock::duration parse_total{};
+    clock::duration parse_max{};
+} state;
+
+double to_ms(clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void print_text(FILE *f, clock::time_point now) {
+    fmt::print(f, "Profile:\n");
+    for (const phase_entry &phase : state.phases) {
+        clock::duration duration =
+            phase.duration ? *phase.duration : now - phase.start;
+        fmt::print(f, "  {:<24}{:>12.3f} ms\n", phase.name, to_ms(duration));
+    }
+    if (state.parse_count == 0)
+        return;
+    fmt::print(f,
+               "  desktop file parsing: {} files, {:.3f} ms total, "
+               "{:.3f} ms max\n",
+               state.parse_count, to_ms(state.parse_total),
+               to_ms(state.parse_max));
+    for (std::size_t i = 0; i < parse_bucket_count; ++i) {
+        if (state.parse_buckets[i] == 0)
+            continue;
+        if (i == parse_bucket_count - 1)
+            fmt::print(f, "    >= {:<8} us {:>10}\n", get_parse_bucket_bound(i),
+                       state.parse_buckets[i]);
+        else
+            fmt::print(f, "    < {:<9} us {:>10}\n",
+                       get_parse_bucket_bound(i + 1), state.parse_buckets[i]);
+    }
+}
+
+void print_json(FILE *f, clock::time_point now) {
+    fmt::print(f, "{{\"phases\":[");
+    for (std::size_t i = 0; i < state.phases.size(); ++i) {
+        const phase_entry &phase = state.phases[i];
+        clock::duration duration =
+            phase.duration ? *phase.duration : now - phase.start;
+        fmt::print(f, "{}{{\"name\":\"{}\",\"ms\":{:.3f}}}",
+                   (i == 0 ? "" : ","), phase.name, to_ms(duration));
+    }
+    fmt::print(f,
+               "],\"parse\":{{\"count\":{},\"total_ms\":{:.3f},"
+               "\"max_ms\":{:.3f},\"histogram\":[",
+               state.parse_count, to_ms(state.parse_total),
+               to_ms(state.parse_max));
+    for (std::size_t i = 0; i < parse_bucket_count; ++i) {
+        fmt::print(f, "{}{{\"min_us\":{},\"count\":{}}}", (i == 0 ? "" : ","),
+                   get_parse_bucket_bound(i), state.parse_buckets[i]);
+    }
+    fmt::print(f, "]}}}}\n");
+}
+}; // namespace
+
+void enable(output_format format) {
+    state.enabled = true;
+    state.format = format;
+}
+
+void disable() {
+    state.enabled = false;
+}
+
+bool is_enabled() {
+    return state.enabled;
+}
+
+Phase::Phase(const char *name) : name(name) {
+    if (Tracer::is_enabled()) {
+        this->traced = true;
+        Tracer::begin(name);
+    }
+    if (!state.enabled)
+        return;
+    this->index = state.phases.size();
+    this->generation = state.generation;
+    this->running = true;
+    state.phases.push_back({name, clock::now(), std::nullopt});
+}
+
+Phase::~Phase() {
+    end();
+}
+
+void Phase::end() {
+    if (this->traced) {
+        this->traced = false;
+        Tracer::end(this->name);
+    }
+    if (!this->running)
+        return;
+    this->running = false;
+    if (!state.enabled || this->generation != state.generation)
+        return;
+    phase_entry &phase = state.phases[this->index];
+    phase.duration = clock::now() - phase.start;
+}
+
+ParseTimer::ParseTimer() {
+    if (state.enabled)
+        this->start = clock::now();
+}
+
+ParseTimer::~ParseTimer() {
+    if (!this->start || !state.enabled)
+        return;
+    clock::duration duration = clock::now() - *this->start;
+    ++state.parse_buckets[get_parse_bucket(duration)];
+    ++state.parse_count;
+    state.parse_total += duration;
+    if (duration > state.parse_max)
+        state.parse_max = duration;
+}
+
+std::size_t get_parse_bucket(clock::duration duration) {
+    auto us =
+        std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    std::size_t bucket = 0;
+    while (us >= 2 && bucket < parse_bucket_count - 1) {
+        us /= 2;
+        ++bucket;
+    }
+    return bucket;
+}
+
+uint64_t get_parse_bucket_bound(std::size_t bucket) {
+    return bucket == 0 ? 0 : (uint64_t)1 << bucket;
+}
+
+void report(FILE *f) {
+    if (!state.enabled)
+        return;
+    clock::time_point now = clock::now();
+    if (state.format == output_format::json)
+        print_json(f, now);
+    else
+        print_text(f, now);
+    fflush(f);
+
+    state.phases.clear();
+    ++state.generation;
+    state.parse_buckets.fill(0);
+    state.parse_count = 0;
+    state.parse_total = {};
+    state.parse_max = {};
+}
+}; // namespace Profiler
@@ -0,0 +1,92 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Profiler measures the duration of individual phases of j4dd and the time
+// spent parsing desktop files. It is enabled by --profile. When disabled,
+// Phase and ParseTimer only check a flag. Phases are also recorded by Tracer.
+
+#ifndef PROFILER_DEF
+#define PROFILER_DEF
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace Profiler
+{
+enum class output_format { text, json };
+
+using clock = std::chrono::steady_clock;
+
+void enable(output_format format);
+void disable();
+bool is_enabled();
+
+// This measures the lifetime of the object. Phases are reported in the order
+// in which they have been started. A phase which is still running is reported
+// with its duration so far, this is used to measure the time until exec().
+class Phase
+{
+public:
+    // name must be a string literal.
+    explicit Phase(const char *name);
+    ~Phase();
+
+    Phase(const Phase &) = delete;
+    void operator=(const Phase &) = delete;
+
+    // End the phase before the object is destroyed.
+    void end();
+
+private:
+    const char *name;
+    std::size_t index;
+    unsigned generation;
+    bool running = false;
+    bool traced = false;
+};
+
+// This measures a parse of a single desktop file.
+class ParseTimer
+{
+public:
+    ParseTimer();
+    ~ParseTimer();
+
+    ParseTimer(const ParseTimer &) = delete;
+    void operator=(const ParseTimer &) = delete;
+
+private:
+    std::optional<clock::time_point> start;
+};
+
+// Print the collected data to f and clear it.
+void report(FILE *f = stderr);
+
+// Parse times are sorted into buckets by powers of two of microseconds. The
+// first bucket contains times shorter than 2 us, the last one contains all
+// times longer than its lower bound.
+constexpr std::size_t parse_bucket_count = 16;
+
+std::size_t get_parse_bucket(clock::duration duration);
+// Lower bound of a bucket in microseconds.
+uint64_t get_parse_bucket_bound(std::size_t bucket);
+}; // namespace Profiler
+
+#endif
@@ -52,8 +52,13 @@ stringlist_t build_search_path(std::string xdg_data_home, std::string home,
     return result;
 }
 
-stringlist_t get_search_path() {
-    return build_search_path(get_variable("XDG_DATA_HOME"),
-                             get_variable("HOME"),
-                             get_variable("XDG_DATA_DIRS"), is_directory);
+static bool assume_directory(const std::string &) {
+    return true;
+}
+
+stringlist_t get_search_path(bool include_missing) {
+    return build_search_path(
+        get_variable("XDG_DATA_HOME"), get_variable("HOME"),
+        get_variable("XDG_DATA_DIRS"),
+        (include_missing ? assume_directory : is_directory));
 }
@@ -27,6 +27,10 @@ stringlist_t build_search_path(std::string xdg_data_home, std::string home,
                                std::string xdg_data_dirs,
                                bool (*is_directory_func)(const std::string &));
 
-stringlist_t get_search_path();
+// Directories which don't exist are left out unless include_missing is true.
+// They are kept to preserve ranks of directories in the search path when
+// some of them may be created later. Only the inotify and polling notifiers
+// watch for their creation, NotifyKqueue ignores them.
+stringlist_t get_search_path(bool include_missing = false);
 
 #endif
@@ -0,0 +1,211 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "Tracer.hh"
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace Tracer
+{
+namespace
+{
+struct event
+{
+    const char *name;
+    // The ph field of the trace event format.
+    char phase;
+    std::chrono::steady_clock::time_point time;
+    int64_t value;
+    // The capacity of this string is reused when the slot is overwritten.
+    std::string detail;
+};
+
+struct state_type
+{
+    bool enabled = false;
+    std::string path;
+
+    std::vector<event> events;
+    // Index of the slot which will be written next.
+    std::size_t next = 0;
+    bool wrapped = false;
+} state;
+
+event &push_event(const char *name, char phase) {
+    event &result = state.events[state.next];
+    if (++state.next == state.events.size()) {
+        state.next = 0;
+        state.wrapped = true;
+    }
+    result.name = name;
+    result.phase = phase;
+    result.time = std::chrono::steady_clock::now();
+    result.value = 0;
+    result.detail.clear();
+    return result;
+}
+
+void write_json_string(std::string &out, std::string_view str) {
+    out += '"';
+    for (char c : str) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default:
+            if ((unsigned char)c < 0x20)
+                out += fmt::format("\\u{:04x}", (unsigned)c);
+            else
+                out += c;
+        }
+    }
+    out += '"';
+}
+
+void write_event(std::string &out, const event &ev, int pid) {
+    auto us = std::chrono::duration<double, std::micro>(
+                  ev.time.time_since_epoch())
+                  .count();
+    out += "{\"name\":";
+    write_json_string(out, ev.name);
+    out += fmt::format(",\"ph\":\"{}\",\"ts\":{:.3f},\"pid\":{},\"tid\":{}",
+                       ev.phase, us, pid, pid);
+    if (ev.phase == 'C')
+        out += fmt::format(",\"args\":{{\"value\":{}}}", ev.value);
+    else if (!ev.detail.empty()) {
+        out += ",\"args\":{\"detail\":";
+        write_json_string(out, ev.detail);
+        out += '}';
+    }
+    if (ev.phase == 'i')
+        out += ",\"s\":\"t\"";
+    out += '}';
+}
+}; // namespace
+
+void enable(std::string path) {
+    state.enabled = true;
+    state.path = std::move(path);
+    state.events.resize(buffer_capacity);
+}
+
+void disable() {
+    state.enabled = false;
+}
+
+bool is_enabled() {
+    return state.enabled;
+}
+
+void begin(const char *name, std::string_view detail) {
+    if (!state.enabled)
+        return;
+    push_event(name, 'B').detail.assign(detail);
+}
+
+void end(const char *name) {
+    if (!state.enabled)
+        return;
+    push_event(name, 'E');
+}
+
+void instant(const char *name, std::string_view detail) {
+    if (!state.enabled)
+        return;
+    push_event(name, 'i').detail.assign(detail);
+}
+
+void counter(const char *name, int64_t value) {
+    if (!state.enabled)
+        return;
+    push_event(name, 'C').value = value;
+}
+
+Span::Span(const char *name, std::string_view detail) : name(name) {
+    if (!state.enabled)
+        return;
+    this->running = true;
+    begin(name, detail);
+}
+
+Span::~Span() {
+    end();
+}
+
+void Span::end() {
+    if (!this->running)
+        return;
+    this->running = false;
+    Tracer::end(this->name);
+}
+
+void dump() {
+    if (!state.enabled)
+        return;
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    int pid = getpid();
+    // Spans are nested, the end of a span whose beginning has been
+    // overwritten is skipped.
+    int depth = 0;
+    bool first = true;
+    std::size_t count = state.wrapped ? state.events.size() : state.next;
+    std::size_t start = state.wrapped ? state.next : 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        const event &ev = state.events[(start + i) % state.events.size()];
+        if (ev.phase == 'B')
+            ++depth;
+        else if (ev.phase == 'E') {
+            if (depth == 0)
+                continue;
+            --depth;
+        }
+        if (!first)
+            out += ",\n";
+        first = false;
+        write_event(out, ev, pid);
+    }
+    out += "]}\n";
+
+    std::string tmp_path = state.path + ".tmp";
+    FILE *f = fopen(tmp_path.c_str(), "w");
+    if (f == NULL) {
+        SPDLOG_ERROR("Couldn't open trace file '{}': {}", tmp_path,
+                     strerror(errno));
+        return;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), state.path.c_str()) == -1) {
+        SPDLOG_ERROR("Couldn't write trace file '{}': {}", state.path,
+                     strerror(errno));
+        unlink(tmp_path.c_str());
+    }
+}
+}; // namespace Tracer
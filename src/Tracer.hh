@@ -0,0 +1,70 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Tracer records spans, instant events and counters into an in-memory ring
+// buffer. It is enabled by --trace-file. The buffer is written to the trace
+// file in the trace event format of chrome://tracing and Perfetto. When
+// disabled, recording functions only check a flag.
+
+#ifndef TRACER_DEF
+#define TRACER_DEF
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+namespace Tracer
+{
+// Number of events kept in the ring buffer. Older events are overwritten.
+constexpr std::size_t buffer_capacity = 65536;
+
+void enable(std::string path);
+void disable();
+bool is_enabled();
+
+// name must be a string literal (or it must otherwise outlive Tracer).
+// detail is shown as an argument of the event.
+void begin(const char *name, std::string_view detail = {});
+void end(const char *name);
+void instant(const char *name, std::string_view detail = {});
+void counter(const char *name, int64_t value);
+
+// This records a span covering the lifetime of the object.
+class Span
+{
+public:
+    explicit Span(const char *name, std::string_view detail = {});
+    ~Span();
+
+    Span(const Span &) = delete;
+    void operator=(const Span &) = delete;
+
+    // End the span before the object is destroyed.
+    void end();
+
+private:
+    const char *name;
+    bool running = false;
+};
+
+// Write the content of the ring buffer to the trace file. The file is
+// replaced atomically, it always contains the most recent events.
+void dump();
+}; // namespace Tracer
+
+#endif
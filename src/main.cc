@@ -31,6 +31,8 @@
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstring>
 #include <errno.h>
 #include <fcntl.h>
@@ -50,6 +52,7 @@
 #include <sys/wait.h>
 #include <type_traits>
 #include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <variant>
@@ -67,8 +70,16 @@
 #include "HistoryManager.hh"
 #include "I3Exec.hh"
 #include "LocaleSuffixes.hh"
+#include "LogSinks.hh"
+#include "MemoryStats.hh"
+#include "MenuSnapshot.hh"
+#include "Metrics.hh"
 #include "NotifyBase.hh"
+#include "NotifyPoll.hh"
+#include "Probes.hh"
+#include "Profiler.hh"
 #include "SearchPath.hh"
+#include "Tracer.hh"
 #include "Utilities.hh"
 #include "version.hh"
 
@@ -126,6 +137,42 @@ static int setup_sigchld_signal() {
     return pipefd[0];
 }
 
+// Run func in a detached process. This is used to do work which shouldn't
+// delay exec() of the selected app. The intermediate child exits right away,
+// so the grandchild which calls func is reparented to init and the app doesn't
+// inherit a child process it doesn't know about. Returns false if the process
+// couldn't be created, func should be called directly in that case.
+template <typename F> static bool run_detached(F &&func) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        SPDLOG_WARN("Couldn't fork: {}", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        pid_t grandchild = fork();
+        if (grandchild != 0)
+            _exit(grandchild == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+        int status = EXIT_SUCCESS;
+        try {
+            func();
+        } catch (const std::exception &e) {
+            SPDLOG_ERROR("{}", e.what());
+            status = EXIT_FAILURE;
+        }
+#ifdef FIX_COVERAGE
+        __gcov_dump();
+#endif
+        _exit(status);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            PFATALE("waitpid");
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
 static void print_usage(FILE *f) {
     fmt::print(
         f,
@@ -155,16 +202,41 @@ static void print_usage(FILE *f) {
         "        Instruct j4-dmenu-desktop on how it should execute terminal\n"
         "        emulator; this also changes the default value of --term.\n"
         "        See the manpage for more info.\n"
+        "    --memory-term-scripts\n"
+        "        Keep temporary scripts for terminal emulator in memory "
+        "instead of\n"
+        "        /tmp. Don't use with client/server terminal emulators.\n"
         "    --usage-log=<file>\n"
         "        Use file as usage log (enables sorting by usage frequency)\n"
         "    --prune-bad-usage-log-entries\n"
         "        Remove names marked in usage log with no corresponding "
         "desktop files\n"
+        "    --usage-log-capacity=<n>\n"
+        "        Keep at most n entries in usage log, remove the least used "
+        "ones\n"
+        "    --frecency\n"
+        "        Sort usage log entries by frecency (recent usage counts "
+        "more)\n"
         "    -x, --use-xdg-de\n"
         "        Enables reading $XDG_CURRENT_DESKTOP to determine the desktop "
         "environment\n"
         "    --wait-on=<path>\n"
         "        Enable daemon mode\n"
+        "    --wait-on-debounce=<ms>\n"
+        "        Apply changes of desktop files in daemon mode after they "
+        "settle\n"
+        "        for ms milliseconds (default 100)\n"
+        "    --poll-interval=<seconds>\n"
+        "        Interval of polling directories on network filesystems in "
+        "daemon\n"
+        "        mode (default 10)\n"
+        "    --poll-path=<path>\n"
+        "        Poll search path directories in path instead of watching "
+        "them\n"
+        "    --menu-snapshot\n"
+        "        Share the menu of a --wait-on daemon with regular invocations "
+        "of\n"
+        "        j4-dmenu-desktop through a snapshot in $XDG_RUNTIME_DIR\n"
         "    --wrapper=<wrapper>\n"
         "        A wrapper binary. Useful in case you want to wrap into 'i3 "
         "exec'\n"
@@ -186,6 +258,25 @@ static void print_usage(FILE *f) {
         "        Specify a log file\n"
         "    --log-file-level=ERROR | WARNING | INFO | DEBUG\n"
         "        Set file log level\n"
+        "    --flight-recorder[=<records>]\n"
+        "        Keep the last records (1024 by default) in memory and write "
+        "them to\n"
+        "        the log file only when an error occurs\n"
+        "    --log-file-async\n"
+        "        Write the log file in a separate thread in daemon mode\n"
+        "    --profile[=text | json]\n"
+        "        Print durations of individual phases of j4-dmenu-desktop to "
+        "stderr\n"
+        "    --trace-file=<file>\n"
+        "        Record a trace of j4-dmenu-desktop's activity and write it to "
+        "file\n"
+        "        in the trace event format (chrome://tracing, Perfetto)\n"
+        "    --metrics-file=<file>\n"
+        "        Save latency metrics of the daemon to file and load them from "
+        "it\n"
+        "    --stats\n"
+        "        Print memory usage of individual subsystems to stderr after "
+        "startup\n"
         "    --version\n"
         "        Display program version\n"
         "    -h, --help\n"
@@ -210,19 +301,45 @@ static void print_usage(FILE *f) {
 namespace SetupPhase
 {
 // This returns absolute paths.
-static Desktop_file_list collect_files(const stringlist_t &search_path) {
+static Desktop_file_rank collect_rank(const string &base_path) {
+    std::vector<string> found_desktop_files;
+    // Missing directories are kept in the search path to preserve ranks
+    // of other directories.
+    if (!is_directory(base_path))
+        return Desktop_file_rank(base_path, std::move(found_desktop_files));
+    FileFinder finder(base_path);
+    while (++finder) {
+        if (finder.isdir() || !endswith(finder.path(), ".desktop"))
+            continue;
+        found_desktop_files.push_back(finder.path());
+    }
+    return Desktop_file_rank(base_path, std::move(found_desktop_files));
+}
+
+// Files of ranks which have already been traversed by a notifier are taken
+// from it.
+static Desktop_file_list
+collect_files(const stringlist_t &search_path,
+              const std::vector<NotifyBase *> &notifiers = {}) {
     Desktop_file_list result;
     result.reserve(search_path.size());
 
-    for (const string &base_path : search_path) {
-        std::vector<string> found_desktop_files;
-        FileFinder finder(base_path);
-        while (++finder) {
-            if (finder.isdir() || !endswith(finder.path(), ".desktop"))
-                continue;
-            found_desktop_files.push_back(finder.path());
+    for (int rank = 0; rank < (int)search_path.size(); ++rank) {
+        std::optional<std::vector<string>> files;
+        for (const NotifyBase *notify : notifiers) {
+            if ((files = notify->list_files(rank)))
+                break;
         }
-        result.emplace_back(base_path, std::move(found_desktop_files));
+        if (!files) {
+            result.push_back(collect_rank(search_path[rank]));
+            continue;
+        }
+        files->erase(std::remove_if(files->begin(), files->end(),
+                                    [](const string &file) {
+                                        return !endswith(file, ".desktop");
+                                    }),
+                     files->end());
+        result.emplace_back(search_path[rank], std::move(*files));
     }
 
     return result;
@@ -232,6 +349,7 @@ static Desktop_file_list collect_files(const stringlist_t &search_path) {
 // a situation where a directory was specified twice in $XDG_DATA_DIRS.
 static void validate_search_path(stringlist_t &search_path) {
     std::unordered_set<std::string> is_unique;
+    std::set<std::pair<dev_t, ino_t>> is_unique_directory;
     auto iter = search_path.begin();
     while (iter != search_path.end()) {
         const std::string &path = *iter;
@@ -245,14 +363,41 @@ static void validate_search_path(stringlist_t &search_path) {
                 iter = search_path.erase(iter);
                 continue;
             }
-            if (!is_unique.emplace(path).second)
+            if (!is_unique.emplace(path).second) {
                 SPDLOG_WARN("$XDG_DATA_DIRS contains duplicate element '{}'!",
                             path);
+                iter = search_path.erase(iter);
+                continue;
+            }
+            // Nix and Guix profiles often reach the same directory through
+            // different symlinks. Files of such a duplicate would be shadowed
+            // by the earlier occurrence anyway. Missing directories are kept,
+            // see get_search_path().
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0 &&
+                !is_unique_directory.emplace(st.st_dev, st.st_ino).second) {
+                SPDLOG_INFO("Directory '{}' has already been found in "
+                            "$XDG_DATA_DIRS under a different path, "
+                            "ignoring...",
+                            path);
+                iter = search_path.erase(iter);
+                continue;
+            }
         }
         ++iter;
     }
 }
 
+// This is used to identify the formatter in --menu-snapshot fingerprint.
+static const char *get_formatter_name(application_formatter formatter) {
+    if (formatter == appformatter_with_binary_name)
+        return "binary";
+    else if (formatter == appformatter_with_base_binary_name)
+        return "binary-base";
+    else
+        return "default";
+}
+
 static unsigned int
 count_collected_desktop_files(const Desktop_file_list &files) {
     unsigned int result = 0;
@@ -266,9 +411,17 @@ count_collected_desktop_files(const Desktop_file_list &files) {
 class NameToAppMapping
 {
 public:
-    using formatted_name_map =
-        std::map<std::string, const Resolved_application, DynamicCompare>;
-    using raw_name_map = AppManager::name_app_mapping_type;
+    using formatted_name_map = std::map<
+        std::string, const Resolved_application, DynamicCompare,
+        MemoryStats::counting_allocator<
+            std::pair<const std::string, const Resolved_application>,
+            MemoryStats::subsystem::formatted_mapping>>;
+    using raw_name_map = std::unordered_map<
+        std::string_view, Resolved_application, std::hash<std::string_view>,
+        std::equal_to<std::string_view>,
+        MemoryStats::counting_allocator<
+            std::pair<const std::string_view, Resolved_application>,
+            MemoryStats::subsystem::raw_mapping>>;
 
     NameToAppMapping(application_formatter app_format, bool case_insensitive,
                      bool exclude_generic)
@@ -278,7 +431,10 @@ public:
     void load(const AppManager &appm) {
         SPDLOG_INFO("Received request to load NameToAppMapping, formatting all "
                     "names...");
-        this->raw_mapping = appm.view_name_app_mapping();
+        const AppManager::name_app_mapping_type &source =
+            appm.view_name_app_mapping();
+        this->raw_mapping = raw_name_map(source.begin(), source.end(),
+                                         source.bucket_count());
 
         this->mapping.clear();
 
@@ -309,6 +465,14 @@ public:
         return this->app_format;
     }
 
+    // Keys of the raw mapping are owned by AppManager.
+    std::size_t owned_string_bytes() const {
+        std::size_t result = 0;
+        for (const auto &[name, resolved] : this->mapping)
+            result += MemoryStats::string_heap_bytes(name);
+        return result;
+    }
+
 private:
     application_formatter app_format;
     formatted_name_map mapping;
@@ -319,56 +483,40 @@ private:
 static_assert(std::is_move_constructible_v<NameToAppMapping>);
 
 // HistoryManager can't save formatted names. This class handles conversion of
-// raw names to formatted ones.
+// raw names to formatted ones. History is ordered either by use count or by
+// frecency.
 class FormattedHistoryManager
 {
 public:
     void reload(const NameToAppMapping &mapping) {
-        const auto &raw_name_lookup = mapping.get_unordered_raw_map();
-
         this->formatted_history.clear();
-        const auto &hist_view = this->hist.view();
-        this->formatted_history.reserve(hist_view.size());
-
-        const auto &format = mapping.view_formatter();
-
-        for (auto iter = hist_view.begin(); iter != hist_view.end(); ++iter) {
-            const std::string &raw_name = iter->second;
-
-            auto lookup_result = raw_name_lookup.find(raw_name);
-            if (lookup_result == raw_name_lookup.end()) {
-                if (this->remove_obsolete_entries) {
-                    SPDLOG_WARN(
-                        "Removing history entry '{}', which doesn't correspond "
-                        "to any known desktop app name.",
-                        raw_name);
-                    iter = this->hist.remove_obsolete_entry(iter);
-                    if (iter == hist_view.end())
-                        break;
-                } else {
-                    SPDLOG_WARN(
-                        "Couldn't find history entry '{}'. Has the program "
-                        "been uninstalled? Has j4-dmenu-desktop been executed "
-                        "with different $XDG_DATA_HOME or $XDG_DATA_DIRS? Use "
-                        "--prune-bad-usage-log-entries "
-                        "to remove these entries.",
-                        raw_name);
-                }
-                continue;
-            }
-            if (this->exclude_generic && lookup_result->second.is_generic)
-                continue;
-            this->formatted_history.push_back(
-                format(raw_name, *lookup_result->second.app));
+        this->formatted_history.reserve(this->hist.view().size());
+
+        std::vector<std::string> obsolete_entries;
+        if (this->use_frecency) {
+            for (const auto &[key, raw_name] : this->hist.frecency_view())
+                add_formatted_entry(mapping, *raw_name, obsolete_entries);
+        } else {
+            for (const auto &[count, raw_name] : this->hist.view())
+                add_formatted_entry(mapping, raw_name, obsolete_entries);
         }
+
+        // Entries can't be removed while the history is being iterated. All
+        // removals are written at once.
+        for (const std::string &raw_name : obsolete_entries)
+            this->hist.remove_obsolete_entry(raw_name);
+        if (!obsolete_entries.empty())
+            this->hist.flush();
     }
 
     FormattedHistoryManager(HistoryManager hist,
                             const NameToAppMapping &mapping,
-                            bool remove_obsolete_entries, bool exclude_generic)
+                            bool remove_obsolete_entries, bool exclude_generic,
+                            bool use_frecency, size_t capacity)
         : hist(std::move(hist)),
           remove_obsolete_entries(remove_obsolete_entries),
-          exclude_generic(exclude_generic) {
+          exclude_generic(exclude_generic), use_frecency(use_frecency) {
+        this->hist.set_capacity(capacity);
         reload(mapping);
     }
 
@@ -388,20 +536,74 @@ public:
         return this->formatted_history;
     }
 
-    void increment(const string &name) {
-        this->hist.increment(name);
+    void queue_increment(const string &name) {
+        this->hist.queue_increment(name);
     }
 
-    void remove_obsolete_entry(
-        HistoryManager::history_mmap_type::const_iterator iter) {
-        this->hist.remove_obsolete_entry(iter);
+    void flush() {
+        this->hist.flush();
+    }
+
+    // Apply changes of the history file made by other processes. Returns true
+    // if the history has changed.
+    bool sync(const NameToAppMapping &mapping) {
+        if (!this->hist.sync())
+            return false;
+        reload(mapping);
+        return true;
+    }
+
+    bool has_queued_records() const {
+        return this->hist.has_queued_records();
+    }
+
+    bool flush_needs_compaction() const {
+        return this->hist.flush_needs_compaction();
+    }
+
+    std::size_t owned_string_bytes() const {
+        std::size_t result = this->hist.owned_string_bytes();
+        for (const std::string &name : this->formatted_history)
+            result += MemoryStats::string_heap_bytes(name);
+        return result;
     }
 
 private:
+    void add_formatted_entry(const NameToAppMapping &mapping,
+                             const std::string &raw_name,
+                             std::vector<std::string> &obsolete_entries) {
+        const auto &raw_name_lookup = mapping.get_unordered_raw_map();
+
+        auto lookup_result = raw_name_lookup.find(raw_name);
+        if (lookup_result == raw_name_lookup.end()) {
+            if (this->remove_obsolete_entries) {
+                SPDLOG_WARN(
+                    "Removing history entry '{}', which doesn't correspond "
+                    "to any known desktop app name.",
+                    raw_name);
+                obsolete_entries.push_back(raw_name);
+            } else {
+                SPDLOG_WARN(
+                    "Couldn't find history entry '{}'. Has the program "
+                    "been uninstalled? Has j4-dmenu-desktop been executed "
+                    "with different $XDG_DATA_HOME or $XDG_DATA_DIRS? Use "
+                    "--prune-bad-usage-log-entries "
+                    "to remove these entries.",
+                    raw_name);
+            }
+            return;
+        }
+        if (this->exclude_generic && lookup_result->second.is_generic)
+            return;
+        this->formatted_history.push_back(
+            mapping.view_formatter()(raw_name, *lookup_result->second.app));
+    }
+
     HistoryManager hist;
     stringlist_t formatted_history;
     bool remove_obsolete_entries;
     bool exclude_generic;
+    bool use_frecency;
 };
 }; // namespace SetupPhase
 
@@ -438,45 +640,50 @@ public:
     }
 };
 
-static std::optional<std::string>
-do_dmenu(Dmenu &dmenu, const name_map &mapping, const stringlist_t &history) {
-    // Check for dmenu errors via SIGPIPE.
-    SIGPIPEHandler sig;
+// Call func(name, resolved) for every entry of the menu in the order in which
+// it should be shown to the user. History entries come first.
+template <typename F>
+static void for_each_menu_entry(const name_map &mapping,
+                                const stringlist_t &history, F &&func) {
+    if (history.empty()) {
+        for (const auto &[name, resolved] : mapping)
+            func(name, resolved);
+        return;
+    }
 
-    // Transfer the names to dmenu
-    if (!history.empty()) {
-        std::set<std::string_view, DynamicCompare> desktop_file_names(
-            mapping.key_comp());
-        for (const auto &[name, ignored] : mapping)
-            desktop_file_names.emplace_hint(desktop_file_names.end(), name);
-        for (const auto &name : history) {
-            // We don't want to display a single element twice. We can't
-            // print history and then desktop name list because names in
-            // history will also be in desktop name list. Also, if there is
-            // a name in history which isn't in desktop name list, it could
-            // mean that the desktop file corresponding to the history name
-            // has been removed, making the history entry obsolete. The
-            // history entry shouldn't be shown if that is the case.
-            if (desktop_file_names.erase(name))
-                dmenu.write(name);
-            else {
-                // This shouldn't happen thanks to FormattedHistoryManager
-                SPDLOG_ERROR(
-                    "A name in history isn't in name list when it should "
-                    "be there!");
-                abort();
-            }
+    // We don't want to display a single element twice. We can't print history
+    // and then desktop name list because names in history will also be in
+    // desktop name list. Also, if there is a name in history which isn't in
+    // desktop name list, it could mean that the desktop file corresponding to
+    // the history name has been removed, making the history entry obsolete.
+    // The history entry shouldn't be shown if that is the case.
+    std::unordered_set<const Resolved_application *> shown;
+    shown.reserve(history.size());
+    for (const auto &name : history) {
+        auto iter = mapping.find(name);
+        if (iter == mapping.end() || !shown.emplace(&iter->second).second) {
+            // This shouldn't happen thanks to FormattedHistoryManager
+            SPDLOG_ERROR("A name in history isn't in name list when it should "
+                         "be there!");
+            abort();
         }
-        for (const auto &name : desktop_file_names)
-            dmenu.write(name);
-    } else {
-        for (const auto &[name, ignored] : mapping)
-            dmenu.write(name);
+        func(iter->first, iter->second);
     }
+    for (const auto &[name, resolved] : mapping) {
+        if (shown.count(&resolved) == 0)
+            func(name, resolved);
+    }
+}
 
+// Display dmenu and wait for the user's response. All names must have been
+// already written to dmenu.
+static std::optional<std::string> read_dmenu_choice(Dmenu &dmenu) {
+    Profiler::Phase phase("selection");
     dmenu.display();
 
     string choice = dmenu.read_choice(); // This blocks
+    phase.end();
+    J4DD_PROBE1(selection, choice.c_str());
     if (choice.empty())
         return {};
     fmt::print(stderr, "User input is: {}\n", choice);
@@ -484,6 +691,28 @@ do_dmenu(Dmenu &dmenu, const name_map &mapping, const stringlist_t &history) {
     return choice;
 }
 
+// If written_at isn't nullptr, it is set to the time when all names have been
+// written to dmenu.
+static std::optional<std::string>
+do_dmenu(Dmenu &dmenu, const name_map &mapping, const stringlist_t &history,
+         std::chrono::steady_clock::time_point *written_at) {
+    // Check for dmenu errors via SIGPIPE.
+    SIGPIPEHandler sig;
+
+    // Transfer the names to dmenu
+    Profiler::Phase phase("dmenu write");
+    for_each_menu_entry(
+        mapping, history,
+        [&dmenu](const std::string &name, const Resolved_application &) {
+            dmenu.write(name);
+        });
+    phase.end();
+    if (written_at != nullptr)
+        *written_at = std::chrono::steady_clock::now();
+
+    return read_dmenu_choice(dmenu);
+}
+
 namespace Lookup
 {
 struct ApplicationLookup
@@ -575,20 +804,15 @@ public:
         this->dmenu.run();
     }
 
-    std::optional<CommandInfoVariant> prompt_user_for_choice() {
-        std::optional<std::string> query =
-            RunPhase::do_dmenu(this->dmenu, this->mapping.get_formatted_map(),
-                               (this->hist_manager ? this->hist_manager->view()
-                                                   : stringlist_t{})); // blocks
-        if (!query) {
-            SPDLOG_INFO("No application has been selected, exiting...");
-            return {};
-        }
-
+    // Resolve the user's choice. If the choice is a desktop app, history_name
+    // is set to the name which should be recorded in history. It is set to
+    // nullptr otherwise.
+    static CommandInfoVariant resolve_choice(const std::string &query,
+                                             const name_map &mapping,
+                                             const std::string *&history_name) {
         using namespace Lookup;
 
-        lookup_res_type lookup =
-            lookup_name(*query, this->mapping.get_formatted_map());
+        lookup_res_type lookup = lookup_name(query, mapping);
         bool is_custom = std::holds_alternative<CommandLookup>(lookup);
 
         if (is_custom)
@@ -596,33 +820,175 @@ public:
         else
             SPDLOG_DEBUG("Selected entry is: desktop app");
 
-        if (is_custom)
+        if (is_custom) {
+            history_name = nullptr;
             return CommandInfoVariant(std::in_place_type_t<CustomCommandInfo>{},
                                       std::get<CommandLookup>(lookup).command);
-        else {
+        } else {
             const ApplicationLookup &appl = std::get<ApplicationLookup>(lookup);
-            if (!this->no_exec && this->hist_manager) {
-                const std::string &name =
-                    (appl.is_generic ? appl.app->generic_name : appl.app->name);
-                this->hist_manager->increment(name);
-            }
+            history_name =
+                (appl.is_generic ? &appl.app->generic_name : &appl.app->name);
             return CommandInfoVariant(
                 std::in_place_type_t<DesktopCommandInfo>{}, appl.app,
                 appl.args);
         }
     }
 
-    void update_mapping(const AppManager &appm) {
-        this->mapping.load(appm);
+    // written_at is passed to do_dmenu().
+    std::optional<CommandInfoVariant> prompt_user_for_choice(
+        std::chrono::steady_clock::time_point *written_at = nullptr) {
+        std::optional<std::string> query =
+            RunPhase::do_dmenu(this->dmenu, this->mapping.get_formatted_map(),
+                               (this->hist_manager ? this->hist_manager->view()
+                                                   : stringlist_t{}),
+                               written_at); // blocks
+        if (!query) {
+            SPDLOG_INFO("No application has been selected, exiting...");
+            return {};
+        }
+
+        const std::string *history_name;
+        CommandInfoVariant result = resolve_choice(
+            *query, this->mapping.get_formatted_map(), history_name);
+        if (history_name != nullptr && !this->no_exec && this->hist_manager) {
+            // The history file is written by flush_history() after the app
+            // has been started.
+            this->hist_manager->queue_increment(*history_name);
+            // The formatted history has to be rebuilt to reflect the new
+            // order. One-shot runs exec() the app right away and never look
+            // at it again, so the daemon postpones this to sync_history()
+            // unless the snapshot has to be updated now.
+            if (this->snapshot) {
+                this->hist_manager->reload(this->mapping);
+                publish_snapshot();
+            } else
+                this->history_outdated = true;
+        }
+        return result;
+    }
+
+    // History can be modified by other j4dd processes. This is used in wait-on
+    // mode before showing the menu.
+    void sync_history() {
+        if (!this->hist_manager)
+            return;
+        Profiler::Phase phase("history sync");
+        bool changed = refresh_history();
+        phase.end();
+        if (changed)
+            publish_snapshot();
+    }
+
+    // One-shot runs which use the menu snapshot record the choice in the
+    // history file themselves. The daemon doesn't get triggered, so it has to
+    // check the history file periodically with poll_history() to keep the
+    // snapshot up to date.
+    bool needs_history_polling() const {
+        return this->snapshot && this->hist_manager;
+    }
+
+    // This is like sync_history(), but it isn't profiled (it would fill the
+    // profile of the next menu invocation).
+    void poll_history() {
+        if (this->hist_manager && refresh_history())
+            publish_snapshot();
+    }
+
+    // Write history changes made by prompt_user_for_choice().
+    void flush_history() {
         if (this->hist_manager)
+            this->hist_manager->flush();
+    }
+
+    // This variant is used right before j4dd exec()s the selected app. An
+    // append to the history file is cheaper than fork(), so it is done
+    // directly. If the history file has to be rewritten, it's done in a
+    // detached process instead.
+    void flush_history_before_exec() {
+        if (!this->hist_manager || !this->hist_manager->has_queued_records())
+            return;
+        if (this->hist_manager->flush_needs_compaction() &&
+            run_detached([this]() { this->hist_manager->flush(); }))
+            return;
+        this->hist_manager->flush();
+    }
+
+    void update_mapping(const AppManager &appm) {
+        {
+            Profiler::Phase phase("name mapping");
+            this->mapping.load(appm);
+        }
+        J4DD_PROBE1(mapping_reload, this->mapping.get_formatted_map().size());
+        if (this->hist_manager) {
+            Profiler::Phase phase("history reload");
             this->hist_manager->reload(this->mapping);
+        }
+        publish_snapshot();
+    }
+
+    // The snapshot is published immediately and then after every change of
+    // the menu.
+    void enable_snapshot(MenuSnapshot::Publisher publisher) {
+        this->snapshot.emplace(std::move(publisher));
+        publish_snapshot();
+    }
+
+    // This removes the snapshot.
+    void disable_snapshot() {
+        this->snapshot.reset();
+    }
+
+    std::string memory_report(const AppManager &appm) const {
+        using MemoryStats::subsystem;
+
+        MemoryStats::owned_strings_type owned_strings{};
+        owned_strings[(std::size_t)subsystem::applications] =
+            appm.owned_string_bytes();
+        owned_strings[(std::size_t)subsystem::formatted_mapping] =
+            this->mapping.owned_string_bytes();
+        if (this->hist_manager)
+            owned_strings[(std::size_t)subsystem::history] =
+                this->hist_manager->owned_string_bytes();
+        return MemoryStats::report(owned_strings);
     }
 
 private:
+    // Returns true if the history has changed.
+    bool refresh_history() {
+        bool changed = this->hist_manager->sync(this->mapping);
+        if (!changed && this->history_outdated) {
+            this->hist_manager->reload(this->mapping);
+            changed = true;
+        }
+        this->history_outdated = false;
+        return changed;
+    }
+
+    void publish_snapshot() {
+        if (!this->snapshot)
+            return;
+
+        std::vector<MenuSnapshot::PublishedEntry> entries;
+        entries.reserve(this->mapping.get_formatted_map().size());
+        for_each_menu_entry(this->mapping.get_formatted_map(),
+                            (this->hist_manager ? this->hist_manager->view()
+                                                : stringlist_t{}),
+                            [&entries](const std::string &name,
+                                       const Resolved_application &resolved) {
+                                entries.emplace_back(name, resolved.app,
+                                                     resolved.is_generic);
+                            });
+        this->snapshot->publish(entries);
+    }
+
     Dmenu dmenu;
     SetupPhase::NameToAppMapping mapping;
     std::optional<SetupPhase::FormattedHistoryManager> hist_manager;
     bool no_exec;
+    // True if formatted history of hist_manager doesn't reflect
+    // queue_increment() yet.
+    bool history_outdated = false;
+    std::optional<MenuSnapshot::Publisher> snapshot;
 };
 }; // namespace RunPhase
 
@@ -633,6 +999,11 @@ namespace ExecutePhase
     SPDLOG_INFO("Executing command: {}", cmdline_string);
 
     auto argv = CMDLineAssembly::create_argv(args);
+    // The exec phase ends here.
+    Tracer::instant("execvp", cmdline_string);
+    J4DD_PROBE1(exec, cmdline_string.c_str());
+    Profiler::report();
+    Tracer::dump();
 #ifdef FIX_COVERAGE
     __gcov_dump();
 #endif
@@ -688,9 +1059,7 @@ public:
         } else {
             const auto &info = std::get<DesktopCommandInfo>(command_info);
 
-            command_array =
-                CMDLineAssembly::convert_exec_to_command(info.app->exec);
-            expand_field_codes(command_array, *info.app, info.args);
+            command_array = info.app->get_exec_template().expand(info.args);
             if (info.app->terminal)
                 command_array =
                     term_assembler(command_array, terminal, info.app->name);
@@ -768,7 +1137,7 @@ class I3Executable final : public BaseExecutable
 public:
     I3Executable(std::string terminal, std::string i3_ipc_path,
                  CMDLineTerm::term_assembler term_assembler)
-        : terminal(std::move(terminal)), i3_ipc_path(std::move(i3_ipc_path)),
+        : terminal(std::move(terminal)), connection(std::move(i3_ipc_path)),
           term_assembler(term_assembler) {}
 
     // This class could be copied or moved, but it wouldn't make much sense in
@@ -796,8 +1165,7 @@ public:
             const auto &info = std::get<DesktopCommandInfo>(command_info);
 
             std::vector<std::string> command_array =
-                CMDLineAssembly::convert_exec_to_command(info.app->exec);
-            expand_field_codes(command_array, *info.app, info.args);
+                info.app->get_exec_template().expand(info.args);
             if (!info.app->path.empty())
                 result = "cd " + CMDLineAssembly::sq_quote(info.app->path) +
                          " && " +
@@ -819,21 +1187,144 @@ public:
         if (!this->wrapper.empty())
             ...
         */
-        I3Interface::exec(result, this->i3_ipc_path);
+        Tracer::Span span("i3 IPC", result);
+        J4DD_PROBE1(exec, result.c_str());
+        this->connection.exec(result);
     }
 
 private:
     std::string terminal;
-    std::string i3_ipc_path;
+    // The connection is kept open for the whole lifetime of j4dd, so that
+    // launching an app in --wait-on mode doesn't have to connect again.
+    I3Interface::Connection connection;
     CMDLineTerm::term_assembler term_assembler;
 };
+
+static std::unique_ptr<BaseExecutable>
+create_executor(bool no_exec, bool use_i3_ipc, std::string terminal,
+                std::string wrapper, const std::string &i3_ipc_path,
+                CMDLineTerm::term_assembler term_mode) {
+    if (no_exec)
+        return std::make_unique<FakeExecutable>(std::move(terminal),
+                                                std::move(wrapper), term_mode);
+    else if (use_i3_ipc)
+        return std::make_unique<I3Executable>(std::move(terminal), i3_ipc_path,
+                                              term_mode);
+    else
+        return std::make_unique<NormalExecutable>(
+            std::move(terminal), std::move(wrapper), term_mode);
+}
 }; // namespace ExecutePhase
 
+// This is used instead of the usual setup when --menu-snapshot is enabled and
+// a --wait-on daemon has published a usable snapshot. Desktop files aren't
+// read at all, the menu is loaded from the snapshot.
+static int run_from_snapshot(Dmenu &dmenu,
+                             const std::vector<MenuSnapshot::Entry> &entries,
+                             bool case_insensitive, const char *usage_log,
+                             size_t usage_log_capacity,
+                             ExecutePhase::BaseExecutable *executor) {
+    RunPhase::name_map mapping{DynamicCompare(case_insensitive)};
+    std::optional<std::string> query;
+    {
+        // Check for dmenu errors via SIGPIPE.
+        RunPhase::SIGPIPEHandler sig;
+
+        // Entries are already in the order in which they should be shown.
+        Profiler::Phase phase("dmenu write");
+        for (const MenuSnapshot::Entry &entry : entries) {
+            dmenu.write(entry.formatted_name);
+            mapping.try_emplace(entry.formatted_name, &entry.app,
+                                entry.is_generic);
+        }
+        phase.end();
+
+        query = RunPhase::read_dmenu_choice(dmenu); // blocks
+    }
+    if (!query) {
+        SPDLOG_INFO("No application has been selected, exiting...");
+        Profiler::report();
+        Tracer::dump();
+        return 0;
+    }
+
+    Profiler::Phase exec_phase("exec");
+    const std::string *history_name;
+    auto command = RunPhase::CommandRetrievalLoop::resolve_choice(
+        *query, mapping, history_name);
+    if (history_name == nullptr || usage_log == nullptr) {
+        executor->execute(command);
+        exec_phase.end();
+        Profiler::report();
+        Tracer::dump();
+        return 0;
+    }
+
+    auto update_history = [usage_log, usage_log_capacity, history_name]() {
+        try {
+            HistoryManager hist(usage_log);
+            hist.set_capacity(usage_log_capacity);
+            hist.increment(*history_name);
+        } catch (const v0_version_error &) {
+            SPDLOG_WARN("History file '{}' is using old format, it won't be "
+                        "updated. Run j4-dmenu-desktop without "
+                        "--menu-snapshot to convert it.",
+                        usage_log);
+        }
+    };
+    // Reading the history file isn't needed to show the menu in this mode, so
+    // it is left to a detached process when the app is exec()ed.
+    if (dynamic_cast<ExecutePhase::NormalExecutable *>(executor) != nullptr) {
+        if (!run_detached(update_history))
+            update_history();
+        executor->execute(command);
+    } else {
+        executor->execute(command);
+        update_history();
+    }
+    exec_phase.end();
+    Profiler::report();
+    Tracer::dump();
+    return 0;
+}
+
+// Every byte written to the --wait-on FIFO except these commands shows the
+// menu. Commands other than quit are control characters, clients may write
+// any printable text to the FIFO to show the menu.
+namespace FifoCommand
+{
+constexpr char quit = 'q';
+constexpr char metrics = '\x0d';         // Ctrl-M
+constexpr char stats = '\x13';           // Ctrl-S
+constexpr char flight_recorder = '\x0c'; // Ctrl-L
+}; // namespace FifoCommand
+
+// The daemon usually doesn't have a useful stderr, replies to FIFO commands are
+// written to <FIFO path>.reply instead. The file is replaced atomically.
+static void write_fifo_reply(const char *wait_on, const std::string &reply) {
+    std::string path = std::string(wait_on) + ".reply";
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0600);
+    if (fd == -1) {
+        SPDLOG_ERROR("Couldn't open '{}': {}", tmp_path, strerror(errno));
+        return;
+    }
+    bool ok = writen(fd, reply.data(), reply.size()) != -1;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) == -1) {
+        SPDLOG_ERROR("Couldn't write '{}': {}", path, strerror(errno));
+        unlink(tmp_path.c_str());
+    }
+}
+
 [[noreturn]] static void
-do_wait_on(NotifyBase &notify, const char *wait_on, AppManager &appm,
+do_wait_on(const std::vector<NotifyBase *> &notifiers, const char *wait_on,
+           AppManager &appm,
            const stringlist_t &search_path,
            RunPhase::CommandRetrievalLoop &command_retrieve,
-           ExecutePhase::BaseExecutable *executor) {
+           ExecutePhase::BaseExecutable *executor,
+           std::chrono::milliseconds debounce, const char *metrics_file) {
     // We need to determine if we're i3 to know if we need to fork before
     // executing a program.
     bool is_i3 =
@@ -853,46 +1344,134 @@ do_wait_on(NotifyBase &notify, const char *wait_on, AppManager &appm,
     fd = open(wait_on, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
     if (fd == -1)
         PFATALE("open");
-    pollfd watch[] = {
+    // The first two entries are fixed, notifiers follow them.
+    // local_sigchld_fd is -1 in i3 mode. i3 mode doesn't exec nor fork, so the
+    // entire SIGCHLD handling mechanism is turned off for it. The signal
+    // handler is not established and poll() ignores negative file
+    // descriptors.
+    std::vector<pollfd> watch = {
         {fd,               POLLIN, 0},
-        {notify.getfd(),   POLLIN, 0},
         {local_sigchld_fd, POLLIN, 0}
     };
-    // Do not process the third entry when in i3 mode
-    // i3 mode doesn't exec nor fork, so the entire SIGCHLD handling mechanism
-    // is turned off for it. The signal handler is not established and poll
-    // disregards it because of nfds (local_sigchld_fd is also set to -1, so
-    // poll() would have ignored it anyway).
-    int nfds = is_i3 ? 2 : 3;
+    for (NotifyBase *notify : notifiers)
+        watch.push_back({notify->getfd(), POLLIN, 0});
+
+    using std::chrono::steady_clock;
+    DaemonMetrics metrics;
+    if (metrics_file != nullptr)
+        metrics.load(metrics_file);
+    auto record_stage = [&metrics](DaemonMetrics::stage stage,
+                                   steady_clock::time_point start,
+                                   steady_clock::time_point end) {
+        metrics.stages[stage].record(
+            std::chrono::duration_cast<std::chrono::microseconds>(end -
+                                                                  start));
+    };
+
+    // Changes of desktop files are applied once no new change has arrived for
+    // debounce milliseconds (or before the menu is shown). A file which is
+    // being written in several steps is therefore read only once.
+    std::map<std::pair<int, std::string>, NotifyBase::changetype>
+        pending_changes;
+    std::set<int> pending_rescans;
+    std::optional<steady_clock::time_point> debounce_deadline;
+    // The history file is checked this often while a menu snapshot is
+    // published.
+    constexpr std::chrono::seconds history_poll_interval(1);
+    std::optional<steady_clock::time_point> history_poll_deadline;
+    if (command_retrieve.needs_history_polling())
+        history_poll_deadline = steady_clock::now() + history_poll_interval;
+    auto apply_pending_changes = [&]() {
+        debounce_deadline.reset();
+        if (pending_changes.empty() && pending_rescans.empty())
+            return;
+        ++metrics.reloads;
+        Profiler::Phase phase("desktop file changes");
+        for (int rank : pending_rescans) {
+            try {
+                appm.reconcile(SetupPhase::collect_rank(search_path[rank]),
+                               rank);
+            } catch (const std::runtime_error &e) {
+                SPDLOG_WARN("Couldn't rescan directory '{}': {}",
+                            search_path[rank], e.what());
+            }
+        }
+        for (const auto &[file, status] : pending_changes) {
+            const auto &[rank, name] = file;
+            // Reconciliation has handled all files of the rank.
+            if (pending_rescans.count(rank) != 0)
+                continue;
+            switch (status) {
+            case NotifyBase::changetype::modified:
+                appm.add(search_path[rank] + name, search_path[rank], rank);
+                break;
+            case NotifyBase::changetype::deleted:
+                appm.remove(search_path[rank] + name, search_path[rank]);
+                break;
+            default:
+                // Shouldn't be reachable.
+                abort();
+            }
+        }
+        pending_changes.clear();
+        pending_rescans.clear();
+        phase.end();
+        command_retrieve.update_mapping(appm);
+#ifdef DEBUG
+        appm.check_inner_state();
+#endif
+    };
+
     while (1) {
-        watch[0].revents = watch[1].revents = watch[2].revents = 0;
+        for (pollfd &entry : watch)
+            entry.revents = 0;
+        std::optional<steady_clock::time_point> deadline = debounce_deadline;
+        if (history_poll_deadline &&
+            (!deadline || *history_poll_deadline < *deadline))
+            deadline = history_poll_deadline;
+        int timeout = -1;
+        if (deadline) {
+            timeout = std::max<long>(
+                std::chrono::ceil<std::chrono::milliseconds>(
+                    *deadline - steady_clock::now())
+                    .count(),
+                0);
+        }
         int ret;
-        while ((ret = poll(watch, nfds, -1)) == -1 && errno == EINTR)
+        while ((ret = poll(watch.data(), watch.size(), timeout)) == -1 &&
+               errno == EINTR)
             ;
         if (ret == -1)
             PFATALE("poll");
-        if (watch[1].revents & POLLIN) {
-            for (const auto &i : notify.getchanges()) {
-                if (!endswith(i.name, ".desktop"))
+        for (size_t n = 0; n < notifiers.size(); ++n) {
+            if (!(watch[n + 2].revents & POLLIN))
+                continue;
+            auto changes = notifiers[n]->getchanges();
+            Tracer::counter("notify events", changes.size());
+            metrics.notify_events += changes.size();
+            for (auto &i : changes) {
+                if (i.status == NotifyBase::changetype::rescan) {
+                    pending_rescans.insert(i.rank);
                     continue;
-                switch (i.status) {
-                case NotifyBase::changetype::modified:
-                    appm.add(search_path[i.rank] + i.name, search_path[i.rank],
-                             i.rank);
-                    break;
-                case NotifyBase::changetype::deleted:
-                    appm.remove(search_path[i.rank] + i.name,
-                                search_path[i.rank]);
-                    break;
-                default:
-                    // Shouldn't be reachable.
-                    abort();
                 }
-                command_retrieve.update_mapping(appm);
-#ifdef DEBUG
-                appm.check_inner_state();
-#endif
+                if (!endswith(i.name, ".desktop"))
+                    continue;
+                // Only the last change of a file matters.
+                pending_changes.insert_or_assign(
+                    std::make_pair(i.rank, std::move(i.name)), i.status);
             }
+            Tracer::counter("pending changes", pending_changes.size());
+            if (debounce.count() == 0)
+                apply_pending_changes();
+            else if (!pending_changes.empty() || !pending_rescans.empty())
+                debounce_deadline = steady_clock::now() + debounce;
+        }
+        if (debounce_deadline && steady_clock::now() >= *debounce_deadline)
+            apply_pending_changes();
+        if (history_poll_deadline &&
+            steady_clock::now() >= *history_poll_deadline) {
+            command_retrieve.poll_history();
+            history_poll_deadline = steady_clock::now() + history_poll_interval;
         }
         if (watch[0].revents & POLLIN) {
             // It can happen that the user tries to execute j4dd several times
@@ -902,6 +1481,7 @@ do_wait_on(NotifyBase &notify, const char *wait_on, AppManager &appm,
             // this.
             char data;
             ssize_t err = read(fd, &data, sizeof(data));
+            steady_clock::time_point triggered_at = steady_clock::now();
             bool nothing_received = false;
             if (err > 0) {
                 while ((err = read(fd, &data, sizeof(data))) == 1)
@@ -923,16 +1503,64 @@ do_wait_on(NotifyBase &notify, const char *wait_on, AppManager &appm,
             }
             // Only the last event is taken into account (there is usually only
             // a single event).
-            if (data == 'q')
+            Tracer::instant("fifo trigger", std::string_view(&data, 1));
+            J4DD_PROBE1(fifo_trigger, data);
+            if (data == FifoCommand::quit) {
+                Tracer::dump();
+                if (metrics_file != nullptr)
+                    metrics.save(metrics_file);
+                // exit() doesn't run destructors of local objects.
+                command_retrieve.disable_snapshot();
                 exit(EXIT_SUCCESS);
+            }
+            if (data == FifoCommand::metrics) {
+                write_fifo_reply(wait_on, metrics.to_text());
+                if (metrics_file != nullptr)
+                    metrics.save(metrics_file);
+                continue;
+            }
+            if (data == FifoCommand::stats) {
+                write_fifo_reply(wait_on, command_retrieve.memory_report(appm));
+                continue;
+            }
+            if (data == FifoCommand::flight_recorder) {
+                if (!LogSinks::dump_flight_recorder())
+                    SPDLOG_WARN("The flight recorder isn't enabled.");
+                continue;
+            }
 
+            // The menu must be up to date.
+            apply_pending_changes();
             command_retrieve.run_dmenu();
-
-            auto user_response = command_retrieve.prompt_user_for_choice();
+            steady_clock::time_point spawned_at = steady_clock::now();
+            command_retrieve.sync_history();
+
+            steady_clock::time_point written_at;
+            auto user_response =
+                command_retrieve.prompt_user_for_choice(&written_at);
+            steady_clock::time_point selected_at = steady_clock::now();
+            ++metrics.triggers;
+            record_stage(DaemonMetrics::spawn, triggered_at, spawned_at);
+            record_stage(DaemonMetrics::write, spawned_at, written_at);
+            record_stage(DaemonMetrics::selection, written_at, selected_at);
             if (user_response) {
-                if (is_i3)
+                Profiler::Phase phase("exec");
+                if (is_i3) {
                     executor->execute(*user_response);
-                else {
+                    record_stage(DaemonMetrics::launch, selected_at,
+                                 steady_clock::now());
+                    command_retrieve.flush_history();
+                } else {
+                    // The write end of this pipe is closed by a successful
+                    // exec() (or by exit of the child). This is used to
+                    // measure the time it takes to launch the app.
+                    int exec_pipe[2];
+                    if (pipe(exec_pipe) == -1)
+                        PFATALE("pipe");
+                    for (int pipe_fd : exec_pipe) {
+                        if (fcntl(pipe_fd, F_SETFD, FD_CLOEXEC) == -1)
+                            PFATALE("fcntl");
+                    }
                     pid_t pid = fork();
                     switch (pid) {
                     case -1:
@@ -940,15 +1568,32 @@ do_wait_on(NotifyBase &notify, const char *wait_on, AppManager &appm,
                         exit(EXIT_FAILURE);
                     case 0:
                         close(fd);
+                        close(exec_pipe[0]);
                         setsid();
+                        // The daemon reports the profile and the trace.
+                        Profiler::disable();
+                        Tracer::disable();
                         // This function can throw. It means that the child
                         // process can jump out to main.
                         executor->execute(*user_response);
                         abort();
                     }
+                    close(exec_pipe[1]);
+                    char dummy;
+                    while (read(exec_pipe[0], &dummy, 1) == -1 &&
+                           errno == EINTR)
+                        ;
+                    close(exec_pipe[0]);
+                    record_stage(DaemonMetrics::launch, selected_at,
+                                 steady_clock::now());
                     processes_to_wait_for.push_back(pid);
+                    command_retrieve.flush_history();
                 }
             }
+            if (metrics_file != nullptr)
+                metrics.save(metrics_file);
+            Profiler::report();
+            Tracer::dump();
         }
         if (watch[0].revents & POLLHUP) {
             // The writing client has closed. We won't be able to poll()
@@ -962,7 +1607,7 @@ do_wait_on(NotifyBase &notify, const char *wait_on, AppManager &appm,
                 PFATALE("open");
             watch[0].fd = fd;
         }
-        if (!is_i3 && watch[2].revents & POLLIN) {
+        if (!is_i3 && watch[1].revents & POLLIN) {
             // Empty the pipe.
             while (true) {
                 char data;
@@ -1046,12 +1691,18 @@ int main(int argc, char **argv) {
 
     const char *log_file_path = nullptr;
     spdlog::level::level_enum log_file_verbosity = spdlog::level::info;
+    // Records are written to the log file only on errors if this isn't 0.
+    size_t flight_recorder_capacity = 0;
+    bool async_log_file = false;
 
     /// Handle arguments
     std::string dmenu_command = "dmenu -i";
     std::string terminal;
     std::string wrapper;
     const char *wait_on = nullptr;
+    unsigned long wait_on_debounce = 100;
+    unsigned long poll_interval = 10;
+    stringlist_t poll_paths;
 
     bool use_xdg_de = false;
     bool exclude_generic = false;
@@ -1062,6 +1713,11 @@ int main(int argc, char **argv) {
     bool use_i3_ipc = false;
     bool skip_i3_check = false;
     bool prune_bad_usage_log_entries = false;
+    bool use_frecency = false;
+    size_t usage_log_capacity = 0;
+    bool use_menu_snapshot = false;
+    bool memory_term_scripts = false;
+    bool print_stats = false;
     int verbose_flag = 0;
 
     bool loglevel_overridden = false;
@@ -1071,6 +1727,7 @@ int main(int argc, char **argv) {
     CMDLineTerm::term_assembler term_mode = CMDLineTerm::default_term_assembler;
 
     const char *usage_log = 0;
+    const char *metrics_file = nullptr;
 
     while (true) {
         int option_index = 0;
@@ -1085,7 +1742,12 @@ int main(int argc, char **argv) {
             {"no-generic",                  no_argument,       0, 'n'},
             {"usage-log",                   required_argument, 0, 'l'},
             {"prune-bad-usage-log-entries", no_argument,       0, 'p'},
+            {"frecency",                    no_argument,       0, 'F'},
+            {"usage-log-capacity",          required_argument, 0, 'C'},
             {"wait-on",                     required_argument, 0, 'w'},
+            {"wait-on-debounce",            required_argument, 0, 'B'},
+            {"poll-interval",               required_argument, 0, 'P'},
+            {"poll-path",                   required_argument, 0, 'N'},
             {"no-exec",                     no_argument,       0, 'e'},
             {"wrapper",                     required_argument, 0, 'W'},
             {"case-insensitive",            no_argument,       0, 'i'},
@@ -1095,6 +1757,14 @@ int main(int argc, char **argv) {
             {"log-file",                    required_argument, 0, 'O'},
             {"log-file-level",              required_argument, 0, 'V'},
             {"version",                     no_argument,       0, 'E'},
+            {"menu-snapshot",               no_argument,       0, 'M'},
+            {"memory-term-scripts",         no_argument,       0, 'D'},
+            {"profile",                     optional_argument, 0, 'R'},
+            {"trace-file",                  required_argument, 0, 'G'},
+            {"metrics-file",                required_argument, 0, 'K'},
+            {"stats",                       no_argument,       0, 'A'},
+            {"flight-recorder",             optional_argument, 0, 'Y'},
+            {"log-file-async",              no_argument,       0, 'Z'},
             {0,                             0,                 0, 0  }
         };
 
@@ -1154,9 +1824,53 @@ int main(int argc, char **argv) {
         case 'p':
             prune_bad_usage_log_entries = true;
             break;
+        case 'F':
+            use_frecency = true;
+            break;
+        case 'C': {
+            char *endptr;
+            errno = 0;
+            usage_log_capacity = strtoul(optarg, &endptr, 10);
+            if (!isdigit((unsigned char)*optarg) || *endptr != '\0' ||
+                errno != 0) {
+                fmt::print(stderr, "Invalid capacity supplied to "
+                                   "--usage-log-capacity!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
         case 'w':
             wait_on = optarg;
             break;
+        case 'B': {
+            char *endptr;
+            errno = 0;
+            wait_on_debounce = strtoul(optarg, &endptr, 10);
+            if (!isdigit((unsigned char)*optarg) || *endptr != '\0' ||
+                errno != 0) {
+                fmt::print(stderr, "Invalid time supplied to "
+                                   "--wait-on-debounce!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'P': {
+            char *endptr;
+            errno = 0;
+            poll_interval = strtoul(optarg, &endptr, 10);
+            if (!isdigit((unsigned char)*optarg) || *endptr != '\0' ||
+                errno != 0 || poll_interval == 0) {
+                fmt::print(stderr, "Invalid interval supplied to "
+                                   "--poll-interval!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'N':
+            poll_paths.emplace_back(optarg);
+            if (poll_paths.back().empty() || poll_paths.back().back() != '/')
+                poll_paths.back() += '/';
+            break;
         case 'e':
             no_exec = true;
             break;
@@ -1213,6 +1927,50 @@ int main(int argc, char **argv) {
         case 'E':
             puts(version());
             exit(EXIT_SUCCESS);
+        case 'M':
+            use_menu_snapshot = true;
+            break;
+        case 'D':
+            memory_term_scripts = true;
+            break;
+        case 'R':
+            if (optarg == nullptr || strcmp(optarg, "text") == 0)
+                Profiler::enable(Profiler::output_format::text);
+            else if (strcmp(optarg, "json") == 0)
+                Profiler::enable(Profiler::output_format::json);
+            else {
+                fmt::print(stderr, "Invalid format supplied to --profile!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'G':
+            Tracer::enable(optarg);
+            break;
+        case 'K':
+            metrics_file = optarg;
+            break;
+        case 'A':
+            print_stats = true;
+            break;
+        case 'Y': {
+            if (optarg == nullptr) {
+                flight_recorder_capacity = 1024;
+                break;
+            }
+            char *endptr;
+            errno = 0;
+            flight_recorder_capacity = strtoul(optarg, &endptr, 10);
+            if (!isdigit((unsigned char)*optarg) || *endptr != '\0' ||
+                errno != 0 || flight_recorder_capacity == 0) {
+                fmt::print(stderr, "Invalid number of records supplied to "
+                                   "--flight-recorder!\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'Z':
+            async_log_file = true;
+            break;
         default:
             exit(1);
         }
@@ -1252,10 +2010,26 @@ int main(int argc, char **argv) {
 
         custom_logger->set_level(common_log_level);
 
-        auto sink =
+        std::shared_ptr<spdlog::sinks::sink> sink =
             std::make_shared<spdlog::sinks::basic_file_sink_st>(log_file_path);
+        if (flight_recorder_capacity != 0) {
+            // Dumps are rare, the file is written synchronously even if
+            // --log-file-async is used.
+            auto recorder = std::make_shared<LogSinks::FlightRecorderSink>(
+                flight_recorder_capacity, std::move(sink));
+            LogSinks::install_flight_recorder(recorder);
+            sink = std::move(recorder);
+        } else if (async_log_file && wait_on) {
+            auto async_sink =
+                std::make_shared<LogSinks::AsyncSink>(std::move(sink));
+            LogSinks::register_async_sink(async_sink);
+            sink = std::move(async_sink);
+        }
         sink->set_level(log_file_verbosity);
         custom_logger->sinks().push_back(std::move(sink));
+    } else if (flight_recorder_capacity != 0) {
+        fmt::print(stderr, "--flight-recorder requires --log-file!\n");
+        exit(EXIT_FAILURE);
     }
 
     stderr_sink.reset();
@@ -1270,11 +2044,8 @@ int main(int argc, char **argv) {
             SPDLOG_ERROR("You can't enable both i3 IPC and a wrapper!");
             exit(EXIT_FAILURE);
         }
-        i3_ipc_path = get_variable("I3SOCK");
-        if (i3_ipc_path.empty()) {
-            // This may abort()/exit()
-            i3_ipc_path = I3Interface::get_ipc_socket_path();
-        }
+        // This may abort()/exit()
+        i3_ipc_path = I3Interface::get_ipc_socket_path();
     }
 
     if (!skip_i3_check) {
@@ -1321,6 +2092,16 @@ int main(int argc, char **argv) {
     if (term_mode == CMDLineTerm::custom_term_assembler)
         CMDLineTerm::validate_custom_term(terminal);
 
+    // Temporary scripts can be kept in memory only when j4dd executes the
+    // terminal emulator itself. It has to outlive the script.
+    if (memory_term_scripts) {
+        if (no_exec || use_i3_ipc || !wrapper.empty())
+            SPDLOG_WARN("--memory-term-scripts has no effect together with "
+                        "--no-exec, -I or --wrapper.");
+        else
+            CMDLineTerm::set_in_memory_scripts(true);
+    }
+
     // Set default value of --term according to --term-mode
     if (terminal.empty()) {
         if (term_mode == CMDLineTerm::default_term_assembler)
@@ -1344,23 +2125,24 @@ int main(int argc, char **argv) {
         dmenu.run();
 
     /// Get search path
-    stringlist_t search_path = get_search_path();
+    Profiler::Phase search_path_phase("search path");
+    // Directories which don't exist yet are included, because the daemon
+    // watches for their creation (except with kqueue, see NotifyKqueue.hh).
+    // One-shot invocations must use the same search path to get the same menu
+    // snapshot fingerprint.
+    stringlist_t search_path = get_search_path(true);
 
     SPDLOG_INFO("Found {} directories in search path:", search_path.size());
     for (const std::string &path : search_path) {
-        SPDLOG_INFO(" {}", path);
+        if (is_directory(path))
+            SPDLOG_INFO(" {}", path);
+        else
+            SPDLOG_INFO(" {} (doesn't exist)", path);
     }
 
     SetupPhase::validate_search_path(search_path);
+    search_path_phase.end();
 
-    /// Collect desktop files
-    auto desktop_file_list = SetupPhase::collect_files(search_path);
-    SPDLOG_DEBUG("The following desktop files have been found:");
-    for (const auto &item : desktop_file_list) {
-        SPDLOG_DEBUG(" {}", item.base_path);
-        for (const std::string &file : item.files)
-            SPDLOG_DEBUG("   {}", file);
-    }
     LocaleSuffixes locales = LocaleSuffixes::from_environment();
     {
         auto suffixes = locales.list_suffixes_for_logging_only();
@@ -1368,8 +2150,110 @@ int main(int argc, char **argv) {
         for (const auto &ptr : suffixes)
             SPDLOG_DEBUG(" {}", *ptr);
     }
+
+    /// Handle menu snapshot
+    std::string snapshot_path;
+    uint64_t snapshot_fingerprint = 0;
+    if (use_menu_snapshot) {
+        stringlist_t settings = {
+            version(),
+            SetupPhase::get_formatter_name(appformatter),
+            (exclude_generic ? "no-generic" : "generic"),
+            (case_insensitive ? "case-insensitive" : "case-sensitive"),
+            join(desktopenvs, ':'),
+            (usage_log ? usage_log : ""),
+            (use_frecency ? "frecency" : "count"),
+            std::to_string(usage_log_capacity),
+            join(search_path, ':')};
+        for (const std::string *suffix :
+             locales.list_suffixes_for_logging_only())
+            settings.push_back(*suffix);
+        snapshot_fingerprint = MenuSnapshot::compute_fingerprint(settings);
+        snapshot_path = MenuSnapshot::get_snapshot_path(snapshot_fingerprint);
+        if (snapshot_path.empty())
+            SPDLOG_WARN("$XDG_RUNTIME_DIR isn't set, menu snapshot is "
+                        "disabled.");
+        else
+            SPDLOG_INFO("Menu snapshot path is '{}'.", snapshot_path);
+    }
+
+    if (!wait_on && !snapshot_path.empty()) {
+        Profiler::Phase snapshot_phase("menu snapshot");
+        auto entries = MenuSnapshot::read(snapshot_path, snapshot_fingerprint);
+        snapshot_phase.end();
+        if (entries) {
+            std::unique_ptr<ExecutePhase::BaseExecutable> executor =
+                ExecutePhase::create_executor(no_exec, use_i3_ipc,
+                                              std::move(terminal),
+                                              std::move(wrapper), i3_ipc_path,
+                                              term_mode);
+            try {
+                return run_from_snapshot(dmenu, *entries, case_insensitive,
+                                         (no_exec ? nullptr : usage_log),
+                                         usage_log_capacity, executor.get());
+            } catch (const CMDLineTerm::initialization_error &e) {
+                fmt::print(stderr,
+                           "Couldn't set up temporary script for terminal "
+                           "emulator: {}",
+                           e.what());
+                exit(EXIT_FAILURE);
+            }
+        }
+        SPDLOG_INFO("Menu snapshot isn't available, loading desktop files...");
+    }
+
+    /// Set up notifiers
+    // In wait-on mode, notifiers are set up before desktop files are collected,
+    // so that no change is missed. They traverse the search path anyway, the
+    // list of desktop files is taken from them.
+#ifdef USE_KQUEUE
+    std::optional<NotifyKqueue> notify;
+#else
+    std::optional<NotifyInotify> notify;
+#endif
+    std::optional<NotifyPoll> poll_notify;
+    std::vector<NotifyBase *> notifiers;
+    if (wait_on) {
+        Profiler::Phase phase("notifier setup");
+        // Directories on network and FUSE filesystems and directories
+        // requested by the user are polled. The native notification mechanism
+        // is used for the rest.
+        std::set<int> polled_ranks;
+        for (int rank = 0; rank < (int)search_path.size(); ++rank) {
+            const string &root = search_path[rank];
+            bool requested =
+                std::any_of(poll_paths.begin(), poll_paths.end(),
+                            [&root](const string &path) {
+                                return startswith(root, path);
+                            });
+            if (requested || NotifyPoll::should_poll(root))
+                polled_ranks.insert(rank);
+        }
+        notify.emplace(search_path, polled_ranks);
+        notifiers.push_back(&*notify);
+        if (!polled_ranks.empty()) {
+            poll_notify.emplace(
+                search_path,
+                std::vector<int>(polled_ranks.begin(), polled_ranks.end()),
+                std::chrono::seconds(poll_interval));
+            notifiers.push_back(&*poll_notify);
+        }
+    }
+
+    /// Collect desktop files
+    Profiler::Phase collect_phase("collect files");
+    auto desktop_file_list = SetupPhase::collect_files(search_path, notifiers);
+    collect_phase.end();
+    SPDLOG_DEBUG("The following desktop files have been found:");
+    for (const auto &item : desktop_file_list) {
+        SPDLOG_DEBUG(" {}", item.base_path);
+        for (const std::string &file : item.files)
+            SPDLOG_DEBUG("   {}", file);
+    }
     /// Construct AppManager
+    Profiler::Phase appmanager_phase("AppManager");
     AppManager appm(desktop_file_list, desktopenvs, std::move(locales));
+    appmanager_phase.end();
 
 #ifdef DEBUG
     appm.check_inner_state();
@@ -1393,58 +2277,83 @@ int main(int argc, char **argv) {
                 appm.count());
 
     /// Format names
+    Profiler::Phase mapping_phase("name mapping");
     SetupPhase::NameToAppMapping mapping(appformatter, case_insensitive,
                                          exclude_generic);
     mapping.load(appm);
+    mapping_phase.end();
 
     /// Initialize history
     std::optional<SetupPhase::FormattedHistoryManager> hist_manager;
 
     if (usage_log != nullptr) {
+        Profiler::Phase phase("history load");
         try {
             hist_manager.emplace(HistoryManager(usage_log), mapping,
-                                 prune_bad_usage_log_entries, exclude_generic);
+                                 prune_bad_usage_log_entries, exclude_generic,
+                                 use_frecency, usage_log_capacity);
         } catch (const v0_version_error &) {
             SPDLOG_WARN("History file is using old format. Automatically "
                         "converting to new one.");
             hist_manager.emplace(
                 HistoryManager::convert_history_from_v0(usage_log, appm),
-                mapping, prune_bad_usage_log_entries, exclude_generic);
+                mapping, prune_bad_usage_log_entries, exclude_generic,
+                use_frecency, usage_log_capacity);
         }
     }
 
     RunPhase::CommandRetrievalLoop command_retrieval_loop(
         std::move(dmenu), std::move(mapping), std::move(hist_manager), no_exec);
 
-    using namespace ExecutePhase;
+    if (wait_on && !snapshot_path.empty()) {
+        try {
+            command_retrieval_loop.enable_snapshot(MenuSnapshot::Publisher(
+                std::move(snapshot_path), snapshot_fingerprint));
+        } catch (const std::runtime_error &e) {
+            SPDLOG_WARN("{} Menu snapshot is disabled.", e.what());
+        }
+    }
 
-    std::unique_ptr<BaseExecutable> executor;
-    if (no_exec)
-        executor = std::make_unique<FakeExecutable>(
-            std::move(terminal), std::move(wrapper), term_mode);
-    else if (use_i3_ipc)
-        executor = std::make_unique<I3Executable>(std::move(terminal),
-                                                  i3_ipc_path, term_mode);
-    else
-        executor = std::make_unique<NormalExecutable>(
-            std::move(terminal), std::move(wrapper), term_mode);
+    std::unique_ptr<ExecutePhase::BaseExecutable> executor =
+        ExecutePhase::create_executor(no_exec, use_i3_ipc, std::move(terminal),
+                                      std::move(wrapper), i3_ipc_path,
+                                      term_mode);
+
+    if (print_stats)
+        fmt::print(stderr, "{}", command_retrieval_loop.memory_report(appm));
 
     try {
         if (wait_on) {
-#ifdef USE_KQUEUE
-            NotifyKqueue notify(search_path);
-#else
-            NotifyInotify notify(search_path);
-#endif
-            do_wait_on(notify, wait_on, appm, search_path,
-                       command_retrieval_loop, executor.get());
+            // This reports the startup.
+            Profiler::report();
+            Tracer::dump();
+            do_wait_on(notifiers, wait_on, appm, search_path,
+                       command_retrieval_loop, executor.get(),
+                       std::chrono::milliseconds(wait_on_debounce),
+                       metrics_file);
             abort();
         } else {
             std::optional<RunPhase::CommandRetrievalLoop::CommandInfoVariant>
                 command = command_retrieval_loop.prompt_user_for_choice();
-            if (!command)
+            if (!command) {
+                Profiler::report();
+                Tracer::dump();
                 return 0;
-            executor->execute(*command);
+            }
+            // execute_app() reports the profile if exec() is used.
+            Profiler::Phase exec_phase("exec");
+            if (dynamic_cast<ExecutePhase::NormalExecutable *>(
+                    executor.get()) != nullptr) {
+                // execute() doesn't return in this case.
+                command_retrieval_loop.flush_history_before_exec();
+                executor->execute(*command);
+            } else {
+                executor->execute(*command);
+                command_retrieval_loop.flush_history();
+            }
+            exec_phase.end();
+            Profiler::report();
+            Tracer::dump();
         }
     } catch (const CMDLineTerm::initialization_error &e) {
         fmt::print(stderr,
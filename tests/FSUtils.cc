@@ -106,12 +106,12 @@ static void rmdir_impl(const std::string &path) {
         enum class file_type { file, directory } ft;
         switch (dirinfo->d_type) {
         case DT_DIR:
-            ft = file_type::file;
+            ft = file_type::directory;
             break;
         case DT_UNKNOWN:
             struct stat info;
-            if (stat(subpath.c_str(), &info) == -1)
-                throw std::runtime_error("Error while calling stat() on '" +
+            if (lstat(subpath.c_str(), &info) == -1)
+                throw std::runtime_error("Error while calling lstat() on '" +
                                          subpath + "': " + strerror(errno));
             ft = S_ISDIR(info.st_mode) ? file_type::directory : file_type::file;
             break;
@@ -122,10 +122,8 @@ static void rmdir_impl(const std::string &path) {
 
         switch (ft) {
         case file_type::directory:
+            // This removes subpath too.
             rmdir_recursive(subpath.c_str());
-            if (rmdir(subpath.c_str()) == -1)
-                throw std::runtime_error("Error while calling rmdir() on '" +
-                                         subpath + "': " + strerror(errno));
             break;
         case file_type::file:
             if (unlink(subpath.c_str()) == -1)
@@ -1018,3 +1018,139 @@ TEST_CASE("Test removing an unknown desktop file", "[AppManager]") {
     REQUIRE_NOTHROW(apps.remove(TEST_FILES "applications/hidden.desktop",
                                 TEST_FILES "applications/"));
 }
+
+TEST_CASE("Test reconciling a rank", "[AppManager]") {
+    std::optional<FSUtils::TempFile> changed_container;
+    try {
+        changed_container.emplace("j4dd-appmanager-unit-test");
+    } catch (std::runtime_error &e) {
+        SKIP(e.what());
+    }
+    FSUtils::TempFile &changed = *changed_container;
+
+    auto copy_to_changed = [&changed](const char *source) {
+        int fd = open(source, O_RDONLY);
+        if (fd == -1)
+            FAIL("Couldn't open desktop file '" << source
+                                                << "': " << strerror(errno));
+        if (ftruncate(changed.get_internal_fd(), 0) == -1)
+            FAIL("Couldn't truncate '" << changed.get_name()
+                                       << "': " << strerror(errno));
+        changed.copy_from_fd(fd);
+        close(fd);
+    };
+
+    copy_to_changed(TEST_FILES "applications/gimp.desktop");
+
+    AppManager apps(
+        {
+            {TEST_FILES "a/applications/",
+             {TEST_FILES "a/applications/chromium.desktop",
+              TEST_FILES "a/applications/firefox.desktop"}},
+            {"/tmp/",                    {changed.get_name()}}
+    },
+        {}, LocaleSuffixes("en_US"));
+
+    // Files can appear and disappear.
+    apps.reconcile({TEST_FILES "a/applications/",
+                    {TEST_FILES "a/applications/firefox.desktop",
+                     TEST_FILES "a/applications/hidden.desktop"}},
+                   0);
+    apps.check_inner_state();
+
+    REQUIRE(apps.count() == 3);
+    {
+        ctype check{
+            {"Firefox",                        "firefox"    },
+            {"Web browser",                    "firefox"    },
+            {"GNU Image Manipulation Program", "gimp-2.8 %U"},
+            {"Image Editor",                   "gimp-2.8 %U"},
+        };
+        REQUIRE(checkmap(apps, check));
+    }
+
+    // Changed files are read again.
+    copy_to_changed(TEST_FILES "applications/htop.desktop");
+    apps.reconcile({"/tmp/", {changed.get_name()}}, 1);
+    apps.check_inner_state();
+
+    REQUIRE(apps.count() == 3);
+    {
+        ctype check{
+            {"Firefox",        "firefox"},
+            {"Web browser",    "firefox"},
+            {"Htop",           "htop"   },
+            {"Process Viewer", "htop"   },
+        };
+        REQUIRE(checkmap(apps, check));
+    }
+}
+
+TEST_CASE("Test desktop files reachable through multiple symlinks",
+          "[AppManager]") {
+    char tmpdirname[] = "/tmp/j4dd-appmanager-unit-test-XXXXXX";
+    if (mkdtemp(tmpdirname) == NULL)
+        SKIP("mkdtemp: " << strerror(errno));
+    std::string dir = tmpdirname;
+    OnExit rmdir_handler = [&dir]() {
+        FSUtils::rmdir_recursive(dir.c_str());
+    };
+
+    // This mimics two Nix profiles sharing a store.
+    std::string a = dir + "/a/", b = dir + "/b/";
+    for (const std::string &profile : {a, b}) {
+        if (mkdir(profile.c_str(), 0777) == -1)
+            FAIL("mkdir: " << strerror(errno));
+    }
+    auto link = [](const char *target, const std::string &name) {
+        if (symlink(target, name.c_str()) == -1)
+            FAIL("symlink: " << strerror(errno));
+    };
+    link(TEST_FILES "applications/htop.desktop", a + "htop.desktop");
+    link(TEST_FILES "applications/htop.desktop", b + "process-viewer.desktop");
+    link(TEST_FILES "applications/hidden.desktop", a + "hidden.desktop");
+    link(TEST_FILES "applications/hidden.desktop", b + "also-hidden.desktop");
+
+    AppManager apps(
+        {
+            {a, {a + "htop.desktop", a + "hidden.desktop"}             },
+            {b, {b + "process-viewer.desktop", b + "also-hidden.desktop"}}
+    },
+        {}, LocaleSuffixes("en_US"));
+    apps.check_inner_state();
+
+    // Every path keeps its own desktop file ID and location.
+    REQUIRE(apps.count() == 4);
+    CHECK(apps.lookup_by_ID("htop.desktop").value().get().location ==
+          a + "htop.desktop");
+    CHECK(apps.lookup_by_ID("process-viewer.desktop").value().get().location ==
+          b + "process-viewer.desktop");
+    CHECK(apps.lookup_by_ID("process-viewer.desktop").value().get().name ==
+          "Htop");
+    CHECK_FALSE(apps.lookup_by_ID("also-hidden.desktop"));
+    {
+        ctype check{
+            {"Htop",           "htop"},
+            {"Process Viewer", "htop"},
+        };
+        REQUIRE(checkmap(apps, check));
+    }
+
+    // The copy must stay usable when the first path is removed.
+    apps.remove(a + "htop.desktop", a);
+    apps.check_inner_state();
+    link(TEST_FILES "applications/htop.desktop", b + "htop.desktop");
+    apps.add(b + "htop.desktop", b, 1);
+    apps.check_inner_state();
+
+    REQUIRE(apps.count() == 4);
+    CHECK(apps.lookup_by_ID("htop.desktop").value().get().location ==
+          b + "htop.desktop");
+    {
+        ctype check{
+            {"Htop",           "htop"},
+            {"Process Viewer", "htop"},
+        };
+        REQUIRE(checkmap(apps, check));
+    }
+}
@@ -22,10 +22,14 @@
 
 #include <catch2/catch_test_macros.hpp>
 
+#include <fstream>
+#include <iterator>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
 #include "CMDLineTerm.hh"
+#include "Utilities.hh"
 
 using namespace CMDLineTerm::assembler_functions;
 using vec = std::vector<std::string>;
@@ -126,3 +130,31 @@ TEST_CASE("Test cmdline in custom term handler", "[CMDLineTerm]") {
         vec{"command", "-e", "!@#$%^&*{}", "''''''''''", "'", "!?$ > /dev/null",
             "-x"});
 }
+
+TEST_CASE("Test in-memory script in custom term assembler", "[CMDLineTerm]") {
+    CMDLineTerm::set_in_memory_scripts(true);
+    OnExit reset = []() { CMDLineTerm::set_in_memory_scripts(false); };
+
+    vec result = custom_term_assembler({"echo", "hello"}, "{script}", "Name");
+    REQUIRE(result.size() == 1);
+    const std::string &script = result.front();
+    if (!startswith(script, "/proc/")) {
+        // memfd_create() isn't available, a regular temporary file has been
+        // created instead.
+        REQUIRE(startswith(script, "/tmp/j4-dmenu-"));
+        unlink(script.c_str());
+        return;
+    }
+
+    std::ifstream stream(script);
+    REQUIRE(stream);
+    std::string contents((std::istreambuf_iterator<char>(stream)),
+                         std::istreambuf_iterator<char>());
+    CHECK(startswith(contents, "#!/bin/sh\n"));
+    CHECK(contents.find("rm ") == std::string::npos);
+    CHECK(contents.find("\nexec ") != std::string::npos);
+
+    // The script must close the descriptor it has been read from.
+    std::string fd = script.substr(script.rfind('/') + 1);
+    CHECK(contents.find("\nexec " + fd + "<&-\n") != std::string::npos);
+}
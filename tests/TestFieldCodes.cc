@@ -19,13 +19,14 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include <errno.h>
+#include <stdexcept>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
-// IWYU pragma: no_include <vector>
+#include <vector>
 
 #include "generated/tests_config.hh"
 
@@ -124,3 +125,30 @@ TEST_CASE("Regression test for issue #18, %c was not escaped",
     stringlist_t cmp({"1234", "--caption", "Regression Test 18"});
     REQUIRE(result == cmp);
 }
+
+TEST_CASE("Test ExecTemplate", "[ApplicationRunner]") {
+    using vec = std::vector<std::string>;
+
+    Application app("Name", "", "cmd pre%Fpost --x=%c %k %% %i", "",
+                    "/location.desktop", false);
+    const ExecTemplate &exec_template = app.get_exec_template();
+    // The template is cached.
+    REQUIRE(&exec_template == &app.get_exec_template());
+
+    auto check = [&](const std::string &user_arguments, const vec &expected) {
+        REQUIRE(exec_template.expand(user_arguments) == expected);
+
+        auto args = CMDLineAssembly::convert_exec_to_command(app.exec);
+        expand_field_codes(args, app, user_arguments);
+        REQUIRE(args == expected);
+    };
+
+    check("", {"cmd", "prepost", "--x=Name", "/location.desktop", "%", "%i"});
+    check("a", {"cmd", "preapost", "--x=Name", "/location.desktop", "%", "%i"});
+    check("a b  c", {"cmd", "prea", "b", "cpost", "--x=Name",
+                     "/location.desktop", "%", "%i"});
+
+    Application invalid("Name", "", "cmd %z", "", "/location.desktop", false);
+    REQUIRE_THROWS_AS(invalid.get_exec_template().expand(""),
+                      std::runtime_error);
+}
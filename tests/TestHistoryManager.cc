@@ -22,15 +22,15 @@
 #include <exception>
 #include <fcntl.h>
 #include <functional>
+#include <iterator>
 #include <map>
 #include <optional>
 #include <stdexcept>
 #include <string.h>
 #include <string> // IWYU pragma: keep
 #include <unistd.h>
-// Both of these aren't used in this file.
-// IWYU pragma: no_include <vector>
-// IWYU pragma: no_include <utility>
+#include <utility>
+#include <vector>
 
 #include "generated/tests_config.hh"
 
@@ -41,9 +41,9 @@
 
 // This function checks that a and b have the same value pairs. If values of the
 // same key are in a different order, this function still marks them equal.
-template <typename Key, typename T, typename Compare>
-static bool compare_maps(const std::multimap<Key, T, Compare> &a,
-                         const std::multimap<Key, T, Compare> &b) {
+template <typename Key, typename T, typename Compare, typename Allocator>
+static bool compare_maps(const std::multimap<Key, T, Compare, Allocator> &a,
+                         const std::multimap<Key, T, Compare, Allocator> &b) {
     if (a.size() != b.size())
         return false;
     for (const auto &[key, value] : a) {
@@ -86,21 +86,21 @@ TEST_CASE("Test loading history", "[History]") {
     }
     close(origfd);
 
-    std::multimap<int, string, std::greater<int>> history = {
+    HistoryManager::history_mmap_type history = {
         {8, "Pinta"       },
         {8, "XScreenSaver"},
         {7, "Kdenlive"    },
         {1, "Thunderbird" },
     };
 
-    std::multimap<int, string, std::greater<int>> history_modified = {
+    HistoryManager::history_mmap_type history_modified = {
         {8, "Pinta"       },
         {8, "XScreenSaver"},
         {8, "Kdenlive"    },
         {1, "Thunderbird" },
     };
 
-    std::multimap<int, string, std::greater<int>> history_added = {
+    HistoryManager::history_mmap_type history_added = {
         {8, "Pinta"       },
         {8, "XScreenSaver"},
         {8, "Kdenlive"    },
@@ -123,6 +123,349 @@ TEST_CASE("Test loading history", "[History]") {
     }
 }
 
+TEST_CASE("Test history increments and removals", "[History]") {
+    std::optional<FSUtils::TempFile> tmpfile_container;
+    try {
+        tmpfile_container.emplace("j4dd-history-unit-test");
+    } catch (std::runtime_error &e) {
+        SKIP(e.what());
+    }
+    FSUtils::TempFile &tmpfile = *tmpfile_container;
+
+    int origfd = open(TEST_FILES "history", O_RDONLY);
+    if (origfd == -1) {
+        SKIP("Couldn't open history file '" << TEST_FILES "history"
+                                            << "': " << strerror(errno));
+    }
+    try {
+        tmpfile.copy_from_fd(origfd);
+    } catch (const std::exception &e) {
+        close(origfd);
+        SKIP("Couldn't copy file '" TEST_FILES "history' to '"
+             << tmpfile.get_name() << ": " << e.what());
+    }
+    close(origfd);
+
+    HistoryManager::history_mmap_type expected = {
+        {9, "Thunderbird" },
+        {8, "XScreenSaver"},
+        {7, "Kdenlive"    },
+        {1, "Pinta"       },
+    };
+
+    {
+        HistoryManager orig(tmpfile.get_name());
+        // The name index must survive a move.
+        HistoryManager hist(std::move(orig));
+
+        for (int i = 0; i < 8; ++i)
+            hist.increment("Thunderbird");
+        REQUIRE(hist.view().begin()->second == "Thunderbird");
+
+        hist.remove_obsolete_entry("Pinta");
+        hist.increment("Pinta");
+
+        REQUIRE(compare_maps(hist.view(), expected));
+    }
+
+    HistoryManager reloaded(tmpfile.get_name());
+    REQUIRE(compare_maps(reloaded.view(), expected));
+}
+
+TEST_CASE("Test queued removals of obsolete history entries", "[History]") {
+    std::optional<FSUtils::TempFile> tmpfile_container;
+    try {
+        tmpfile_container.emplace("j4dd-history-unit-test");
+    } catch (std::runtime_error &e) {
+        SKIP(e.what());
+    }
+    FSUtils::TempFile &tmpfile = *tmpfile_container;
+
+    HistoryManager hist(tmpfile.get_name());
+    hist.increment("Firefox");
+    hist.increment("Firefox");
+    hist.increment("Pinta");
+    hist.increment("Gimp");
+
+    hist.remove_obsolete_entry("Pinta");
+    hist.remove_obsolete_entry("Gimp");
+    hist.remove_obsolete_entry("Unknown");
+    HistoryManager::history_mmap_type expected = {
+        {2, "Firefox"},
+    };
+    REQUIRE(compare_maps(hist.view(), expected));
+    CHECK(hist.has_queued_records());
+    // Removals aren't written until flush().
+    CHECK(HistoryManager(tmpfile.get_name()).view().size() == 3);
+
+    hist.flush();
+    CHECK_FALSE(hist.has_queued_records());
+    HistoryManager reloaded(tmpfile.get_name());
+    REQUIRE(compare_maps(reloaded.view(), expected));
+}
+
+TEST_CASE("Test history journal", "[History]") {
+    std::optional<FSUtils::TempFile> tmpfile_container;
+    try {
+        tmpfile_container.emplace("j4dd-history-unit-test");
+    } catch (std::runtime_error &e) {
+        SKIP(e.what());
+    }
+    FSUtils::TempFile &tmpfile = *tmpfile_container;
+
+    int origfd = open(TEST_FILES "journal-history", O_RDONLY);
+    if (origfd == -1) {
+        SKIP("Couldn't open history file '" << TEST_FILES "journal-history"
+                                            << "': " << strerror(errno));
+    }
+    try {
+        tmpfile.copy_from_fd(origfd);
+    } catch (const std::exception &e) {
+        close(origfd);
+        SKIP("Couldn't copy file '" TEST_FILES "journal-history' to '"
+             << tmpfile.get_name() << ": " << e.what());
+    }
+    close(origfd);
+
+    // The incomplete last record is ignored.
+    HistoryManager::history_mmap_type history = {
+        {9, "Kdenlive"    },
+        {8, "Pinta"       },
+        {8, "XScreenSaver"},
+        {1, "Firefox"     },
+    };
+
+    HistoryManager::history_mmap_type history_modified = {
+        {9, "Kdenlive"    },
+        {9, "Pinta"       },
+        {8, "XScreenSaver"},
+        {1, "Firefox"     },
+    };
+
+    {
+        HistoryManager hist(tmpfile.get_name());
+        REQUIRE(compare_maps(hist.view(), history));
+        hist.increment("Pinta");
+        REQUIRE(compare_maps(hist.view(), history_modified));
+    }
+    {
+        HistoryManager hist(tmpfile.get_name());
+        REQUIRE(compare_maps(hist.view(), history_modified));
+
+        // Enough records to trigger compaction several times.
+        for (int i = 0; i < 1000; ++i)
+            hist.increment("Firefox");
+        history_modified.erase(std::prev(history_modified.end()));
+        history_modified.emplace(1001, "Firefox");
+        REQUIRE(compare_maps(hist.view(), history_modified));
+    }
+    {
+        HistoryManager hist(tmpfile.get_name());
+        REQUIRE(compare_maps(hist.view(), history_modified));
+
+        // Queued increments are visible immediately, but they are written
+        // only by flush().
+        hist.queue_increment("Kdenlive");
+        CHECK(hist.has_queued_records());
+        CHECK(compare_maps(HistoryManager(tmpfile.get_name()).view(),
+                           history_modified));
+        hist.flush();
+        CHECK_FALSE(hist.has_queued_records());
+    }
+    history_modified = {
+        {1001, "Firefox"     },
+        {10,   "Kdenlive"    },
+        {9,    "Pinta"       },
+        {8,    "XScreenSaver"},
+    };
+
+    HistoryManager hist(tmpfile.get_name());
+    REQUIRE(compare_maps(hist.view(), history_modified));
+}
+
+TEST_CASE("Test history shared by several processes", "[History]") {
+    std::optional<FSUtils::TempFile> tmpfile_container;
+    try {
+        tmpfile_container.emplace("j4dd-history-unit-test");
+    } catch (std::runtime_error &e) {
+        SKIP(e.what());
+    }
+    FSUtils::TempFile &tmpfile = *tmpfile_container;
+
+    // Two HistoryManagers act as two separate j4dd processes.
+    HistoryManager first(tmpfile.get_name());
+    HistoryManager second(tmpfile.get_name());
+
+    // The history file is empty, so it will be compacted (replaced) first.
+    first.increment("Firefox");
+    second.increment("Htop");
+    HistoryManager::history_mmap_type history = {
+        {1, "Firefox"},
+        {1, "Htop"   },
+    };
+    REQUIRE(compare_maps(second.view(), history));
+
+    // Appended records are picked up.
+    first.sync();
+    REQUIRE(compare_maps(first.view(), history));
+    CHECK_FALSE(first.sync());
+    second.increment("Firefox");
+    CHECK(first.sync());
+    history = {
+        {2, "Firefox"},
+        {1, "Htop"   },
+    };
+    REQUIRE(compare_maps(first.view(), history));
+
+    // Compaction by one of them mustn't lose records of the other.
+    for (int i = 0; i < 1000; ++i)
+        first.increment("Htop");
+    second.queue_increment("Eagle");
+    second.increment("Firefox");
+    history = {
+        {1001, "Htop"   },
+        {3,    "Firefox"},
+        {1,    "Eagle"  },
+    };
+    REQUIRE(compare_maps(second.view(), history));
+    CHECK(first.sync());
+    REQUIRE(compare_maps(first.view(), history));
+
+    HistoryManager reloaded(tmpfile.get_name());
+    REQUIRE(compare_maps(reloaded.view(), history));
+}
+
+// Returns names of frecency_view() in order.
+static std::vector<string> get_frecency_order(const HistoryManager &hist) {
+    std::vector<string> result;
+    for (const auto &[key, name] : hist.frecency_view())
+        result.push_back(*name);
+    return result;
+}
+
+TEST_CASE("Test history frecency", "[History]") {
+    std::optional<FSUtils::TempFile> tmpfile_container;
+    try {
+        tmpfile_container.emplace("j4dd-history-unit-test");
+    } catch (std::runtime_error &e) {
+        SKIP(e.what());
+    }
+    FSUtils::TempFile &tmpfile = *tmpfile_container;
+
+    const time_t day = 24 * 60 * 60;
+    const time_t start = 1000000000;
+
+    HistoryManager::history_mmap_type history = {
+        {10, "Old"   },
+        {3,  "Recent"},
+        {1,  "New"   },
+    };
+
+    {
+        HistoryManager hist(tmpfile.get_name());
+        for (int i = 0; i < 10; ++i)
+            hist.increment("Old", start);
+        for (int i = 0; i < 3; ++i)
+            hist.increment("Recent", start + 60 * day);
+        hist.increment("New", start + 61 * day);
+        REQUIRE(compare_maps(hist.view(), history));
+
+        // Uses of Old have decayed over four half-lives.
+        CHECK(get_frecency_order(hist) ==
+              std::vector<string>{"Recent", "New", "Old"});
+
+        // A single use doesn't beat three recent uses, but it beats them
+        // after enough time has passed.
+        hist.increment("Old", start + 62 * day);
+        CHECK(get_frecency_order(hist) ==
+              std::vector<string>{"Recent", "Old", "New"});
+        hist.increment("New", start + 120 * day);
+        CHECK(get_frecency_order(hist) ==
+              std::vector<string>{"New", "Recent", "Old"});
+    }
+
+    history = {
+        {11, "Old"   },
+        {3,  "Recent"},
+        {2,  "New"   },
+    };
+    HistoryManager hist(tmpfile.get_name());
+    REQUIRE(compare_maps(hist.view(), history));
+    CHECK(get_frecency_order(hist) ==
+          std::vector<string>{"New", "Recent", "Old"});
+
+    // Time going backwards mustn't break anything. These uses are counted
+    // as if they happened at the time of the last use.
+    hist.increment("Old", start);
+    hist.increment("Old", start);
+    CHECK(get_frecency_order(hist) ==
+          std::vector<string>{"New", "Old", "Recent"});
+}
+
+TEST_CASE("Test history capacity", "[History]") {
+    std::optional<FSUtils::TempFile> tmpfile_container;
+    try {
+        tmpfile_container.emplace("j4dd-history-unit-test");
+    } catch (std::runtime_error &e) {
+        SKIP(e.what());
+    }
+    FSUtils::TempFile &tmpfile = *tmpfile_container;
+
+    const time_t start = 1000000000;
+
+    {
+        HistoryManager hist(tmpfile.get_name());
+        hist.set_capacity(2);
+        hist.increment("Firefox", start);
+        hist.increment("Firefox", start);
+        hist.increment("Htop", start + 1);
+        // The new entry must not evict itself even though it has the lowest
+        // frecency.
+        hist.increment("Eagle", start + 2);
+        HistoryManager::history_mmap_type history = {
+            {2, "Firefox"},
+            {1, "Eagle"  },
+        };
+        REQUIRE(compare_maps(hist.view(), history));
+    }
+    {
+        // Lowering the capacity evicts entries immediately.
+        HistoryManager hist(tmpfile.get_name());
+        hist.set_capacity(1);
+        HistoryManager::history_mmap_type history = {
+            {2, "Firefox"},
+        };
+        REQUIRE(compare_maps(hist.view(), history));
+        hist.increment("Firefox", start + 3);
+    }
+
+    HistoryManager hist(tmpfile.get_name());
+    HistoryManager::history_mmap_type history = {
+        {3, "Firefox"},
+    };
+    REQUIRE(compare_maps(hist.view(), history));
+}
+
+TEST_CASE("Test frecency of legacy history", "[History]") {
+    // Entries of legacy formats are ordered by their count.
+    HistoryManager hist(TEST_FILES "history");
+    std::vector<string> expected;
+    for (const auto &[count, name] : hist.view())
+        expected.push_back(name);
+    std::vector<string> order = get_frecency_order(hist);
+
+    REQUIRE(order.size() == expected.size());
+    auto count_iter = hist.view().begin();
+    for (size_t i = 0; i < order.size(); ++i, ++count_iter) {
+        // Entries with the same count may be in a different order.
+        auto range = hist.view().equal_range(count_iter->first);
+        bool found = false;
+        for (auto iter = range.first; iter != range.second; ++iter)
+            found = found || iter->second == order[i];
+        CHECK(found);
+    }
+}
+
 TEST_CASE("Test too new history", "[History]") {
     REQUIRE_THROWS(HistoryManager(TEST_FILES "too-new-history"));
 }
@@ -131,6 +474,10 @@ TEST_CASE("Test bad history with empty entry", "[History]") {
     REQUIRE_THROWS(HistoryManager(TEST_FILES "bad-history"));
 }
 
+TEST_CASE("Test bad history with malformed entry", "[History]") {
+    REQUIRE_THROWS(HistoryManager(TEST_FILES "bad-count-history"));
+}
+
 TEST_CASE("Test conversion from v0 to v1", "[History]") {
     std::optional<FSUtils::TempFile> tmpfile_container;
     try {
@@ -154,7 +501,7 @@ TEST_CASE("Test conversion from v0 to v1", "[History]") {
     }
     close(origfd);
 
-    std::multimap<int, string, std::greater<int>> history = {
+    HistoryManager::history_mmap_type history = {
         {7, "Htop"                          },
         {7, "Process Viewer"                },
         {3, "Image Editor"                  },
@@ -208,7 +555,7 @@ TEST_CASE("Test imperfect conversion from history v0 to v1", "[History]") {
     }
     close(origfd);
 
-    std::multimap<int, string, std::greater<int>> history = {
+    HistoryManager::history_mmap_type history = {
         {3, "Eagle"},
     };
 
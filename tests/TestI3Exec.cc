@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <utility>
 
 #include "FSUtils.hh"
 #include "I3Exec.hh"
@@ -164,3 +165,59 @@ TEST_CASE("Test I3Exec", "[I3Exec]") {
 
     REQUIRE((query == check1 || query == check2));
 }
+
+TEST_CASE("Test I3Exec reconnection", "[I3Exec]") {
+    char tmpdirname[] = "/tmp/j4dd-i3-unit-test-XXXXXX";
+    if (mkdtemp(tmpdirname) == NULL) {
+        SKIP("mkdtemp: " << strerror(errno));
+    }
+
+    path = tmpdirname;
+    OnExit rmdir_handler = []() {
+        rmdir();
+        path.clear();
+    };
+
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sfd == -1)
+        SKIP("socket: " << strerror(errno));
+
+    OnExit sfd_close = [sfd]() { close(sfd); };
+
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    fmt::format_to(addr.sun_path, "{}/socket", tmpdirname);
+
+    if (bind(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == -1) {
+        SKIP("bind: " << strerror(errno));
+    }
+    if (listen(sfd, 2) == -1) {
+        SKIP("listen: " << strerror(errno));
+    }
+
+    // read_request_server() closes the connection after responding. The
+    // second exec() must notice this and reconnect.
+    auto server = std::async(std::launch::async, [sfd]() {
+        string first = read_request_server(sfd);
+        string second = read_request_server(sfd);
+        return std::make_pair(std::move(first), std::move(second));
+    });
+
+    {
+        I3Interface::Connection connection((string)tmpdirname + "/socket");
+        connection.exec("true");
+        connection.exec("false");
+    }
+
+    using namespace std::chrono_literals;
+    if (server.wait_for(2s) == std::future_status::timeout) {
+        FAIL("I3 dummy server is taking too long to respond!");
+    }
+    auto [first, second] = server.get();
+
+    CHECK((first == construct_i3_message("exec true") ||
+           first == construct_i3_message("exec \"true\"")));
+    CHECK((second == construct_i3_message("exec false") ||
+           second == construct_i3_message("exec \"false\"")));
+}
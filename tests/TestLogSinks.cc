@@ -0,0 +1,103 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <spdlog/common.h>
+#include <spdlog/logger.h>
+#include <spdlog/sinks/ostream_sink.h>
+
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "LogSinks.hh"
+
+TEST_CASE("Test flight recorder sink", "[LogSinks]") {
+    std::ostringstream output;
+    auto target = std::make_shared<spdlog::sinks::ostream_sink_st>(output);
+    target->set_pattern("%l %v");
+    auto recorder =
+        std::make_shared<LogSinks::FlightRecorderSink>(3, target);
+    spdlog::logger logger("", recorder);
+    logger.set_level(spdlog::level::debug);
+
+    for (int i = 1; i <= 5; ++i)
+        logger.debug("record {}", i);
+    logger.flush();
+    CHECK(output.str().empty());
+
+    logger.error("failure");
+    std::string dump = output.str();
+    CHECK(dump.find("record 3") == std::string::npos);
+    CHECK(dump.find("debug record 4\n") != std::string::npos);
+    CHECK(dump.find("debug record 5\n") != std::string::npos);
+    CHECK(dump.find("error failure\n") != std::string::npos);
+    CHECK(dump.find("record 4") < dump.find("record 5"));
+
+    // The ring is emptied by a dump.
+    output.str("");
+    recorder->dump();
+    CHECK(output.str().find("debug record") == std::string::npos);
+    logger.info("record 6");
+    recorder->dump();
+    CHECK(output.str().find("info record 6\n") != std::string::npos);
+}
+
+TEST_CASE("Test async sink", "[LogSinks]") {
+    std::ostringstream output;
+    {
+        auto target = std::make_shared<spdlog::sinks::ostream_sink_st>(output);
+        auto async_sink = std::make_shared<LogSinks::AsyncSink>(target);
+        async_sink->set_pattern("%v");
+        spdlog::logger logger("", async_sink);
+        for (int i = 0; i < 100; ++i)
+            logger.warn("record {}", i);
+    }
+    // All records must be written when the sink is destroyed.
+    std::string result = output.str();
+    CHECK(result.find("record 0\n") == 0);
+    CHECK(result.find("record 99\n") != std::string::npos);
+}
+
+TEST_CASE("Test async sink in a forked child", "[LogSinks]") {
+    std::ostringstream output;
+    auto target = std::make_shared<spdlog::sinks::ostream_sink_st>(output);
+    auto async_sink = std::make_shared<LogSinks::AsyncSink>(target);
+    async_sink->set_pattern("%v");
+    LogSinks::register_async_sink(async_sink);
+    spdlog::logger logger("", async_sink);
+
+    // The writer thread doesn't exist in the child, records must be written
+    // directly there.
+    pid_t pid = fork();
+    REQUIRE(pid != -1);
+    if (pid == 0) {
+        logger.warn("from child");
+        bool written = output.str() == "from child\n";
+        _exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    int status;
+    REQUIRE(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status));
+    CHECK(WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    LogSinks::register_async_sink(nullptr);
+}
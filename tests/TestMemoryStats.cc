@@ -0,0 +1,96 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <optional>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "LineReader.hh"
+#include "MemoryStats.hh"
+
+using MemoryStats::subsystem;
+
+TEST_CASE("Test counting allocator", "[MemoryStats]") {
+    MemoryStats::usage before = MemoryStats::get_usage(subsystem::raw_mapping);
+    {
+        std::vector<int, MemoryStats::counting_allocator<
+                             int, subsystem::raw_mapping>>
+            vec;
+        vec.reserve(100);
+        const MemoryStats::usage &during =
+            MemoryStats::get_usage(subsystem::raw_mapping);
+        CHECK(during.live_bytes == before.live_bytes + 100 * sizeof(int));
+        CHECK(during.live_allocations == before.live_allocations + 1);
+        CHECK(during.total_allocations == before.total_allocations + 1);
+        CHECK(during.peak_bytes >= during.live_bytes);
+
+        vec.reserve(1000);
+        CHECK(during.live_bytes == before.live_bytes + 1000 * sizeof(int));
+        CHECK(during.total_allocations == before.total_allocations + 2);
+    }
+    const MemoryStats::usage &after =
+        MemoryStats::get_usage(subsystem::raw_mapping);
+    CHECK(after.live_bytes == before.live_bytes);
+    CHECK(after.live_allocations == before.live_allocations);
+    CHECK(after.peak_bytes >= before.live_bytes + 1000 * sizeof(int));
+}
+
+TEST_CASE("Test LineReader accounting", "[MemoryStats]") {
+    FILE *f = tmpfile();
+    REQUIRE(f != NULL);
+    std::string line(1000, 'a');
+    fputs(line.c_str(), f);
+    fputc('\n', f);
+    rewind(f);
+
+    MemoryStats::usage before = MemoryStats::get_usage(subsystem::line_reader);
+    {
+        LineReader reader;
+        REQUIRE(reader.getline(f) == 1001);
+        const MemoryStats::usage &during =
+            MemoryStats::get_usage(subsystem::line_reader);
+        CHECK(during.live_bytes > before.live_bytes + 1000);
+        CHECK(during.live_allocations == before.live_allocations + 1);
+
+        std::optional<LineReader> moved(std::move(reader));
+        CHECK(during.live_allocations == before.live_allocations + 1);
+    }
+    fclose(f);
+    const MemoryStats::usage &after =
+        MemoryStats::get_usage(subsystem::line_reader);
+    CHECK(after.live_bytes == before.live_bytes);
+    CHECK(after.live_allocations == before.live_allocations);
+}
+
+TEST_CASE("Test owned string accounting", "[MemoryStats]") {
+    CHECK(MemoryStats::string_heap_bytes(std::string()) == 0);
+    CHECK(MemoryStats::string_heap_bytes("short") == 0);
+    std::string long_string(1000, 'a');
+    CHECK(MemoryStats::string_heap_bytes(long_string) ==
+          long_string.capacity() + 1);
+
+    MemoryStats::owned_strings_type owned_strings{};
+    owned_strings[(std::size_t)subsystem::applications] = 123456;
+    owned_strings[(std::size_t)subsystem::history] = 654321;
+    std::string report = MemoryStats::report(owned_strings);
+    CHECK(report.find("owned strings") != std::string::npos);
+    CHECK(report.find("123456\n") != std::string::npos);
+    CHECK(report.find("777777\n") != std::string::npos);
+}
@@ -0,0 +1,116 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/core.h>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Application.hh"
+#include "MenuSnapshot.hh"
+
+static std::string get_test_snapshot_path() {
+    return fmt::format("/tmp/j4dd-menu-snapshot-unit-test-{}", getpid());
+}
+
+TEST_CASE("Test menu snapshot round trip", "[MenuSnapshot]") {
+    Application firefox("Firefox", "Web Browser", "firefox %u", "",
+                        "/usr/share/applications/firefox.desktop", false);
+    Application htop("htop", "Process Viewer", "htop", "/tmp",
+                     "/usr/share/applications/htop.desktop", true);
+
+    uint64_t fingerprint = MenuSnapshot::compute_fingerprint({"a", "b"});
+    std::string path = get_test_snapshot_path();
+
+    MenuSnapshot::Publisher publisher(path, fingerprint);
+    // Nothing has been published yet.
+    REQUIRE_FALSE(MenuSnapshot::read(path, fingerprint));
+
+    publisher.publish({
+        {"htop",        &htop,    false},
+        {"Firefox",     &firefox, false},
+        {"Web Browser", &firefox, true },
+    });
+
+    auto entries = MenuSnapshot::read(path, fingerprint);
+    REQUIRE(entries);
+    REQUIRE(entries->size() == 3);
+    CHECK(entries->at(0).formatted_name == "htop");
+    CHECK_FALSE(entries->at(0).is_generic);
+    CHECK(entries->at(0).app.exec == "htop");
+    CHECK(entries->at(0).app.path == "/tmp");
+    CHECK(entries->at(0).app.terminal);
+    CHECK(entries->at(2).formatted_name == "Web Browser");
+    CHECK(entries->at(2).is_generic);
+    CHECK(entries->at(2).app.generic_name == "Web Browser");
+    CHECK(entries->at(2).app.location ==
+          "/usr/share/applications/firefox.desktop");
+
+    // Republishing a bigger menu must enlarge the snapshot.
+    std::vector<MenuSnapshot::PublishedEntry> many;
+    std::vector<std::string> names;
+    names.reserve(2000);
+    for (int i = 0; i < 2000; ++i)
+        names.push_back(fmt::format("Application number {}", i));
+    for (const std::string &name : names)
+        many.emplace_back(name, &firefox, false);
+    publisher.publish(many);
+
+    entries = MenuSnapshot::read(path, fingerprint);
+    REQUIRE(entries);
+    REQUIRE(entries->size() == 2000);
+    CHECK(entries->back().formatted_name == "Application number 1999");
+
+    // A snapshot of a different configuration must be ignored.
+    CHECK_FALSE(MenuSnapshot::read(
+        path, MenuSnapshot::compute_fingerprint({"a", "c"})));
+}
+
+TEST_CASE("Test menu snapshot cleanup", "[MenuSnapshot]") {
+    std::string path = get_test_snapshot_path();
+    uint64_t fingerprint = MenuSnapshot::compute_fingerprint({});
+    {
+        MenuSnapshot::Publisher publisher(path, fingerprint);
+        REQUIRE(access(path.c_str(), F_OK) == 0);
+    }
+    CHECK(access(path.c_str(), F_OK) == -1);
+    CHECK_FALSE(MenuSnapshot::read(path, fingerprint));
+}
+
+TEST_CASE("Test menu snapshot owned by another publisher", "[MenuSnapshot]") {
+    Application htop("htop", "Process Viewer", "htop", "",
+                     "/usr/share/applications/htop.desktop", true);
+
+    std::string path = get_test_snapshot_path();
+    uint64_t fingerprint = MenuSnapshot::compute_fingerprint({});
+    MenuSnapshot::Publisher publisher(path, fingerprint);
+    publisher.publish({
+        {"htop", &htop, false},
+    });
+
+    // The second publisher must neither truncate nor remove the snapshot.
+    CHECK_THROWS_AS(MenuSnapshot::Publisher(path, fingerprint),
+                    std::runtime_error);
+    auto entries = MenuSnapshot::read(path, fingerprint);
+    REQUIRE(entries);
+    CHECK(entries->size() == 1);
+}
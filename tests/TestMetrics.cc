@@ -0,0 +1,84 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <stdint.h>
+
+#include "Metrics.hh"
+
+using std::chrono::microseconds;
+
+TEST_CASE("Test latency histogram buckets", "[Metrics]") {
+    for (uint64_t value : {0, 1, 15, 16, 17, 31, 32, 33, 1000, 123456789}) {
+        std::size_t bucket = LatencyHistogram::get_bucket(value);
+        INFO("value " << value);
+        CHECK(LatencyHistogram::get_bucket_upper_bound(bucket) >= value);
+        if (bucket > 0)
+            CHECK(LatencyHistogram::get_bucket_upper_bound(bucket - 1) <
+                  value);
+    }
+}
+
+TEST_CASE("Test latency histogram percentiles", "[Metrics]") {
+    LatencyHistogram hist;
+    CHECK(hist.percentile(50) == microseconds(0));
+
+    for (int i = 1; i <= 1000; ++i)
+        hist.record(microseconds(i * 100));
+    CHECK(hist.count() == 1000);
+    CHECK(hist.max() == microseconds(100000));
+    CHECK(hist.mean() == microseconds(50050));
+
+    // The relative error must be at most 1/16.
+    auto check_percentile = [&hist](double percentile, int64_t expected) {
+        int64_t result = hist.percentile(percentile).count();
+        INFO("percentile " << percentile << ", result " << result);
+        CHECK(result >= expected);
+        CHECK(result <= expected + expected / 16);
+    };
+    check_percentile(50, 50000);
+    check_percentile(90, 90000);
+    check_percentile(99, 99000);
+    CHECK(hist.percentile(100) == microseconds(100000));
+}
+
+TEST_CASE("Test daemon metrics JSON round trip", "[Metrics]") {
+    DaemonMetrics metrics;
+    metrics.triggers = 3;
+    metrics.notify_events = 42;
+    metrics.reloads = 7;
+    metrics.stages[DaemonMetrics::spawn].record(microseconds(1500));
+    metrics.stages[DaemonMetrics::spawn].record(microseconds(2500));
+    metrics.stages[DaemonMetrics::launch].record(microseconds(12));
+
+    DaemonMetrics loaded;
+    REQUIRE(loaded.load_json(metrics.to_json()));
+    CHECK(loaded.to_json() == metrics.to_json());
+    CHECK(loaded.triggers == 3);
+    CHECK(loaded.notify_events == 42);
+    CHECK(loaded.reloads == 7);
+    CHECK(loaded.stages[DaemonMetrics::spawn].count() == 2);
+    CHECK(loaded.stages[DaemonMetrics::spawn].max() == microseconds(2500));
+    CHECK(loaded.stages[DaemonMetrics::write].count() == 0);
+
+    // Malformed input must leave the metrics unchanged.
+    CHECK_FALSE(loaded.load_json("{\"triggers\":1,"));
+    CHECK_FALSE(loaded.load_json(""));
+    CHECK(loaded.triggers == 3);
+}
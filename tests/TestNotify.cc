@@ -18,17 +18,23 @@
 #include <catch2/catch_test_macros.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <chrono>
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <string>
 #include <unistd.h>
-// IWYU pragma: no_include <vector>
-// IWYU pragma: no_include <string>
+#include <vector>
 
 #include "generated/tests_config.hh"
 
 #include "NotifyBase.hh"
+#include "NotifyPoll.hh"
 #include "Utilities.hh"
 
 #ifdef USE_KQUEUE
@@ -99,3 +105,293 @@ TEST_CASE("Test detection of file creation and deletion of a subdirectory of "
     REQUIRE(found);
     REQUIRE(poll(&towait, 1, 0) == 0);
 }
+
+#ifndef USE_KQUEUE
+#define TEST_CHUNKED_FILENAME TEST_FILES "usr/local/share/chunkedfile"
+#define TEST_LINK_FILENAME TEST_FILES "usr/local/share/linkedfile"
+
+// Collect changes of name (relative to TEST_FILES "usr/") until no event
+// arrives for timeout ms.
+static std::vector<NotifyBase::changetype>
+collect_changes(NotifyInotify &notify, const std::string &name, int timeout) {
+    std::vector<NotifyBase::changetype> result;
+    pollfd towait = {notify.getfd(), POLLIN, 0};
+    while (poll(&towait, 1, timeout) == 1) {
+        for (const auto &i : notify.getchanges()) {
+            if (i.name == name) {
+                REQUIRE(i.rank == 0);
+                result.push_back(i.status);
+            }
+        }
+    }
+    return result;
+}
+
+TEST_CASE("Test detection of files written in chunks and of links",
+          "[Notify]") {
+    using changes = std::vector<NotifyBase::changetype>;
+    const std::string chunked_name = "local/share/chunkedfile";
+    const std::string link_name = "local/share/linkedfile";
+
+    // Clean up after a failed test.
+    unlink(TEST_CHUNKED_FILENAME);
+    unlink(TEST_LINK_FILENAME);
+
+    stringlist_t search_path({TEST_FILES "usr/"});
+    NotifyInotify notify(search_path);
+
+    int fd = open(TEST_CHUNKED_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        FAIL("Couldn't create " TEST_CHUNKED_FILENAME ": " << strerror(errno));
+    // Neither the creation nor the writes (IN_MODIFY) are reported, the file
+    // isn't complete yet.
+    REQUIRE(writen(fd, "[Desktop Entry]\n", 16) != -1);
+    CHECK(collect_changes(notify, chunked_name, 100).empty());
+    REQUIRE(writen(fd, "Name=Chunked\n", 13) != -1);
+    CHECK(collect_changes(notify, chunked_name, 100).empty());
+    REQUIRE(writen(fd, "Exec=chunked\n", 13) != -1);
+    close(fd);
+    CHECK(collect_changes(notify, chunked_name, 200) ==
+          changes{NotifyBase::modified});
+
+    // Symlinks and hard links aren't written to, they must be reported when
+    // they are created.
+    if (symlink("chunkedfile", TEST_LINK_FILENAME) == -1)
+        FAIL("Couldn't create " TEST_LINK_FILENAME ": " << strerror(errno));
+    CHECK(collect_changes(notify, link_name, 200) ==
+          changes{NotifyBase::modified});
+    unlink(TEST_LINK_FILENAME);
+    CHECK(collect_changes(notify, link_name, 200) ==
+          changes{NotifyBase::deleted});
+
+    if (link(TEST_CHUNKED_FILENAME, TEST_LINK_FILENAME) == -1)
+        FAIL("Couldn't create " TEST_LINK_FILENAME ": " << strerror(errno));
+    CHECK(collect_changes(notify, link_name, 200) ==
+          changes{NotifyBase::modified});
+
+    unlink(TEST_LINK_FILENAME);
+    unlink(TEST_CHUNKED_FILENAME);
+}
+#endif
+
+#define TEST_DIRNAME TEST_FILES "usr/local/share/newdir"
+#define TEST_MOVED_DIRNAME TEST_FILES "newdir-moved"
+#define TEST_SUBDIR_FILENAME "local/share/newdir/nested/newfile"
+
+#ifndef USE_KQUEUE
+// Wait for a change of TEST_SUBDIR_FILENAME and return its status.
+static NotifyBase::changetype wait_for_subdir_file(NotifyInotify &notify) {
+    pollfd towait = {notify.getfd(), POLLIN, 0};
+    while (poll(&towait, 1, 5000) == 1) {
+        for (const auto &i : notify.getchanges()) {
+            if (i.name == TEST_SUBDIR_FILENAME) {
+                REQUIRE(i.rank == 0);
+                return i.status;
+            }
+        }
+    }
+    FAIL("Notify didn't detect the change of " TEST_SUBDIR_FILENAME);
+    abort();
+}
+
+TEST_CASE("Test detection of files in newly created directories", "[Notify]") {
+    // Clean up after a failed test.
+    (void)system("rm -rf '" TEST_DIRNAME "' '" TEST_MOVED_DIRNAME "'");
+
+    stringlist_t search_path({TEST_FILES "usr/"});
+    NotifyInotify notify(search_path);
+
+    if (mkdir(TEST_DIRNAME, 0777) == -1 ||
+        mkdir(TEST_DIRNAME "/nested", 0777) == -1)
+        FAIL("Couldn't create " TEST_DIRNAME ": " << strerror(errno));
+    FILE *file = fopen(TEST_DIRNAME "/nested/newfile", "w");
+    if (!file)
+        FAIL("Couldn't create a file in " TEST_DIRNAME ": "
+             << strerror(errno));
+    fmt::print(file, "DATA");
+    fclose(file);
+
+    REQUIRE(wait_for_subdir_file(notify) == NotifyBase::modified);
+
+    // Moving the directory out of the search path deletes its files.
+    if (rename(TEST_DIRNAME, TEST_MOVED_DIRNAME) == -1)
+        FAIL("Couldn't move " TEST_DIRNAME ": " << strerror(errno));
+    REQUIRE(wait_for_subdir_file(notify) == NotifyBase::deleted);
+
+    // Moving it back adds them again.
+    if (rename(TEST_MOVED_DIRNAME, TEST_DIRNAME) == -1)
+        FAIL("Couldn't move " TEST_MOVED_DIRNAME ": " << strerror(errno));
+    REQUIRE(wait_for_subdir_file(notify) == NotifyBase::modified);
+
+    // Deletion of the whole subtree is detected too.
+    pollfd towait = {notify.getfd(), POLLIN, 0};
+    while (poll(&towait, 1, 100) == 1)
+        notify.getchanges();
+    if (system("rm -rf '" TEST_DIRNAME "'") != 0)
+        FAIL("Couldn't remove " TEST_DIRNAME);
+    REQUIRE(wait_for_subdir_file(notify) == NotifyBase::deleted);
+}
+
+#define TEST_MISSING_ROOT TEST_FILES "missing-root/"
+#define TEST_MISSING_ROOT_DIRNAME TEST_MISSING_ROOT "share/applications/"
+
+// Wait for a change of file name in rank and return its status.
+static NotifyBase::changetype
+wait_for_root_file(NotifyInotify &notify, int rank, const char *name) {
+    pollfd towait = {notify.getfd(), POLLIN, 0};
+    while (poll(&towait, 1, 5000) == 1) {
+        for (const auto &i : notify.getchanges()) {
+            if (i.rank == rank && i.name == name)
+                return i.status;
+        }
+    }
+    FAIL("Notify didn't detect the change of " << name);
+    abort();
+}
+
+TEST_CASE("Test recovery from inotify queue overflow", "[Notify]") {
+    int max_queued_events;
+    FILE *limit = fopen("/proc/sys/fs/inotify/max_queued_events", "r");
+    if (limit == NULL)
+        SKIP("Couldn't determine the size of inotify event queue");
+    if (fscanf(limit, "%d", &max_queued_events) != 1) {
+        fclose(limit);
+        SKIP("Couldn't determine the size of inotify event queue");
+    }
+    fclose(limit);
+
+    stringlist_t search_path({TEST_FILES "usr/"});
+    NotifyInotify notify(search_path);
+
+    // Every iteration generates at least two events.
+    for (int i = 0; i < max_queued_events / 2 + 1; ++i) {
+        FILE *file = fopen(TEST_FILENAME, "w");
+        if (!file)
+            FAIL("Couldn't create " TEST_FILENAME ": " << strerror(errno));
+        fclose(file);
+        if (unlink(TEST_FILENAME) == -1)
+            FAIL("Couldn't remove " TEST_FILENAME ": " << strerror(errno));
+    }
+
+    bool rescan = false;
+    for (const auto &i : notify.getchanges()) {
+        if (i.status == NotifyBase::rescan) {
+            REQUIRE(i.rank == 0);
+            rescan = true;
+        }
+    }
+    REQUIRE(rescan);
+
+    // The directory is watched again after the overflow.
+    FILE *file = fopen(TEST_FILENAME, "w");
+    if (!file)
+        FAIL("Couldn't create " TEST_FILENAME ": " << strerror(errno));
+    fmt::print(file, "DATA");
+    fclose(file);
+    REQUIRE(wait_for_root_file(notify, 0, "local/share/newfile") ==
+            NotifyBase::modified);
+    if (unlink(TEST_FILENAME) == -1)
+        FAIL("Couldn't remove " TEST_FILENAME ": " << strerror(errno));
+}
+
+static void create_missing_root() {
+    if (system("mkdir -p '" TEST_MISSING_ROOT_DIRNAME "' && "
+               "echo DATA > '" TEST_MISSING_ROOT_DIRNAME "app.desktop'") != 0)
+        FAIL("Couldn't create " TEST_MISSING_ROOT_DIRNAME);
+}
+
+TEST_CASE("Test detection of creation of missing search path directories",
+          "[Notify]") {
+    // Clean up after a failed test.
+    (void)system("rm -rf '" TEST_MISSING_ROOT "'");
+
+    stringlist_t search_path({TEST_FILES "usr/", TEST_MISSING_ROOT_DIRNAME});
+    NotifyInotify notify(search_path);
+
+    create_missing_root();
+    REQUIRE(wait_for_root_file(notify, 1, "app.desktop") ==
+            NotifyBase::modified);
+
+    // The root can disappear and it can be created again.
+    if (system("rm -rf '" TEST_MISSING_ROOT "'") != 0)
+        FAIL("Couldn't remove " TEST_MISSING_ROOT);
+    REQUIRE(wait_for_root_file(notify, 1, "app.desktop") ==
+            NotifyBase::deleted);
+
+    create_missing_root();
+    REQUIRE(wait_for_root_file(notify, 1, "app.desktop") ==
+            NotifyBase::modified);
+
+    if (system("rm -rf '" TEST_MISSING_ROOT "'") != 0)
+        FAIL("Couldn't remove " TEST_MISSING_ROOT);
+}
+#endif
+
+TEST_CASE("Test listing of files found by notifiers", "[Notify]") {
+    stringlist_t search_path({TEST_FILES "usr/local/share/applications/",
+                              TEST_FILES "usr/share/applications/"});
+    std::vector<std::string> expected = {
+        TEST_FILES "usr/share/applications/collision.desktop",
+        TEST_FILES "usr/share/applications/couldbehidden.desktop"};
+
+#ifndef USE_KQUEUE
+    NotifyInotify notify(search_path, {0});
+    CHECK_FALSE(notify.list_files(0));
+    REQUIRE(notify.list_files(1) == expected);
+#endif
+
+    NotifyPoll poll_notify(search_path, {1}, std::chrono::seconds(10));
+    CHECK_FALSE(poll_notify.list_files(0));
+    auto files = poll_notify.list_files(1);
+    REQUIRE(files);
+    std::sort(files->begin(), files->end());
+    REQUIRE(*files == expected);
+}
+
+TEST_CASE("Test detection of changes by polling", "[Notify]") {
+    // Clean up after a failed test.
+    (void)system("rm -rf '" TEST_DIRNAME "'");
+
+    stringlist_t search_path({TEST_FILES "usr/"});
+    NotifyPoll notify(search_path, {0}, std::chrono::milliseconds(10));
+
+    auto wait_for_change = [&notify](const char *name) {
+        pollfd towait = {notify.getfd(), POLLIN, 0};
+        while (poll(&towait, 1, 5000) == 1) {
+            for (const auto &i : notify.getchanges()) {
+                if (i.rank == 0 && i.name == name)
+                    return i.status;
+            }
+        }
+        FAIL("Notify didn't detect the change of " << name);
+        abort();
+    };
+
+    if (mkdir(TEST_DIRNAME, 0777) == -1 ||
+        mkdir(TEST_DIRNAME "/nested", 0777) == -1)
+        FAIL("Couldn't create " TEST_DIRNAME ": " << strerror(errno));
+    FILE *file = fopen(TEST_DIRNAME "/nested/newfile", "w");
+    if (!file)
+        FAIL("Couldn't create a file in " TEST_DIRNAME ": "
+             << strerror(errno));
+    fmt::print(file, "DATA");
+    fclose(file);
+    REQUIRE(wait_for_change(TEST_SUBDIR_FILENAME) == NotifyBase::modified);
+
+    // Replacing a file is detected too.
+    file = fopen(TEST_DIRNAME "/nested/replacement", "w");
+    if (!file)
+        FAIL("Couldn't create a file in " TEST_DIRNAME ": "
+             << strerror(errno));
+    fmt::print(file, "OTHER DATA");
+    fclose(file);
+    if (rename(TEST_DIRNAME "/nested/replacement",
+               TEST_DIRNAME "/nested/newfile") == -1)
+        FAIL("Couldn't replace a file in " TEST_DIRNAME ": "
+             << strerror(errno));
+    REQUIRE(wait_for_change(TEST_SUBDIR_FILENAME) == NotifyBase::modified);
+
+    if (system("rm -rf '" TEST_DIRNAME "'") != 0)
+        FAIL("Couldn't remove " TEST_DIRNAME);
+    REQUIRE(wait_for_change(TEST_SUBDIR_FILENAME) == NotifyBase::deleted);
+}
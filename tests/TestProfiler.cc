@@ -0,0 +1,118 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include "Profiler.hh"
+
+using std::chrono::microseconds;
+
+TEST_CASE("Test parse histogram buckets", "[Profiler]") {
+    CHECK(Profiler::get_parse_bucket_bound(0) == 0);
+    CHECK(Profiler::get_parse_bucket_bound(1) == 2);
+    CHECK(Profiler::get_parse_bucket_bound(2) == 4);
+    CHECK(Profiler::get_parse_bucket_bound(3) == 8);
+
+    CHECK(Profiler::get_parse_bucket(microseconds(0)) == 0);
+    CHECK(Profiler::get_parse_bucket(microseconds(1)) == 0);
+    CHECK(Profiler::get_parse_bucket(microseconds(2)) == 1);
+    CHECK(Profiler::get_parse_bucket(microseconds(3)) == 1);
+    CHECK(Profiler::get_parse_bucket(microseconds(4)) == 2);
+    CHECK(Profiler::get_parse_bucket(microseconds(7)) == 2);
+    CHECK(Profiler::get_parse_bucket(microseconds(8)) == 3);
+
+    // Every value belongs to the bucket whose bounds surround it.
+    for (uint64_t value : {5, 100, 1023, 1024, 1025, 20000}) {
+        std::size_t bucket = Profiler::get_parse_bucket(microseconds(value));
+        INFO("value " << value);
+        CHECK(Profiler::get_parse_bucket_bound(bucket) <= value);
+        CHECK(Profiler::get_parse_bucket_bound(bucket + 1) > value);
+    }
+
+    // The last bucket is open-ended.
+    const std::size_t last = Profiler::parse_bucket_count - 1;
+    uint64_t last_bound = Profiler::get_parse_bucket_bound(last);
+    CHECK(Profiler::get_parse_bucket(microseconds(last_bound)) == last);
+    CHECK(Profiler::get_parse_bucket(microseconds(last_bound - 1)) ==
+          last - 1);
+    CHECK(Profiler::get_parse_bucket(microseconds(last_bound * 1000)) == last);
+    CHECK(Profiler::get_parse_bucket(std::chrono::hours(1)) == last);
+}
+
+// Run report() and return what it has printed.
+static std::string get_report() {
+    FILE *f = tmpfile();
+    REQUIRE(f != NULL);
+    Profiler::report(f);
+    rewind(f);
+    std::string result;
+    char buf[256];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof buf, f)) > 0)
+        result.append(buf, len);
+    fclose(f);
+    return result;
+}
+
+TEST_CASE("Test profiler JSON report", "[Profiler]") {
+    Profiler::enable(Profiler::output_format::json);
+    {
+        Profiler::Phase first("first phase");
+        Profiler::Phase second("second phase");
+        second.end();
+        Profiler::ParseTimer timer;
+    }
+    std::string report = get_report();
+    Profiler::disable();
+
+    INFO("report " << report);
+    CHECK(report.rfind("{\"phases\":[{\"name\":\"first phase\",\"ms\":", 0) ==
+          0);
+    CHECK(report.find("},{\"name\":\"second phase\",\"ms\":") !=
+          std::string::npos);
+    CHECK(report.find("],\"parse\":{\"count\":1,\"total_ms\":") !=
+          std::string::npos);
+    CHECK(report.find(",\"max_ms\":") != std::string::npos);
+
+    // All buckets are listed with their lower bounds.
+    std::size_t histogram = report.find(",\"histogram\":[");
+    REQUIRE(histogram != std::string::npos);
+    std::size_t pos = histogram;
+    for (std::size_t i = 0; i < Profiler::parse_bucket_count; ++i) {
+        std::string bucket =
+            "{\"min_us\":" +
+            std::to_string(Profiler::get_parse_bucket_bound(i)) +
+            ",\"count\":";
+        INFO("bucket " << i);
+        pos = report.find(bucket, pos);
+        REQUIRE(pos != std::string::npos);
+    }
+    CHECK(report.find("{\"min_us\":", pos + 1) == std::string::npos);
+    CHECK(report.size() >= 4);
+    CHECK(report.compare(report.size() - 4, 4, "]}}\n") == 0);
+
+    // The report clears the collected data.
+    Profiler::enable(Profiler::output_format::json);
+    report = get_report();
+    Profiler::disable();
+    CHECK(report.rfind("{\"phases\":[],\"parse\":{\"count\":0,", 0) == 0);
+}
@@ -0,0 +1,74 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/core.h>
+
+#include <fstream>
+#include <iterator>
+#include <stddef.h>
+#include <string>
+#include <unistd.h>
+
+#include "Tracer.hh"
+#include "Utilities.hh"
+
+static std::string read_trace(const std::string &path) {
+    std::ifstream stream(path);
+    return std::string(std::istreambuf_iterator<char>(stream),
+                       std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("Test trace file output", "[Tracer]") {
+    std::string path =
+        fmt::format("/tmp/j4dd-tracer-unit-test-{}.json", getpid());
+    OnExit cleanup = [&path]() {
+        Tracer::disable();
+        unlink(path.c_str());
+    };
+
+    // Nothing is recorded while Tracer is disabled.
+    Tracer::instant("before enable");
+    Tracer::enable(path);
+    {
+        Tracer::Span span("outer", "file \"a\"\\b");
+        Tracer::counter("changes", 42);
+    }
+    Tracer::dump();
+
+    std::string trace = read_trace(path);
+    CHECK(trace.find("before enable") == std::string::npos);
+    CHECK(trace.find(R"("name":"outer","ph":"B")") != std::string::npos);
+    CHECK(trace.find(R"("name":"outer","ph":"E")") != std::string::npos);
+    CHECK(trace.find(R"("detail":"file \"a\"\\b")") != std::string::npos);
+    CHECK(trace.find(R"("args":{"value":42})") != std::string::npos);
+
+    // When the ring buffer overflows, only the most recent events are kept.
+    // An end of a span whose beginning has been overwritten is left out.
+    Tracer::begin("overwritten");
+    for (size_t i = 0; i < Tracer::buffer_capacity - 1; ++i)
+        Tracer::instant("filler");
+    Tracer::end("overwritten");
+    Tracer::instant("last");
+    Tracer::dump();
+
+    trace = read_trace(path);
+    CHECK(trace.find("outer") == std::string::npos);
+    CHECK(trace.find("overwritten") == std::string::npos);
+    CHECK(trace.find("\"last\"") != std::string::npos);
+}
@@ -0,0 +1,430 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// j4-dmenu-bench measures the throughput of the desktop file parser on a
+// synthetic corpus generated by CorpusGenerator. Results can be saved as a
+// baseline, later runs warn when they drift away from it.
+
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <errno.h>
+#include <fstream>
+#include <getopt.h>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "Application.hh"
+#include "CorpusGenerator.hh"
+#include "LineReader.hh"
+#include "LocaleSuffixes.hh"
+#include "Utilities.hh"
+
+namespace
+{
+struct Result
+{
+    std::string name;
+    double files_per_second;
+    double mb_per_second;
+};
+
+// Keys and values of the corpus which are passed to the individual parts of
+// the parser.
+struct Inputs
+{
+    std::vector<std::string> locales;
+    std::vector<std::pair<std::string, std::string>> strings;
+    std::vector<std::pair<std::string, std::string>> lists;
+    size_t locale_bytes = 0;
+    size_t string_bytes = 0;
+    size_t list_bytes = 0;
+};
+
+// This prevents the compiler from optimizing the benchmarked code away.
+volatile size_t sink;
+
+void print_usage(FILE *f) {
+    fmt::print(
+        f,
+        "Usage:\n"
+        "    j4-dmenu-bench [options]\n"
+        "Options:\n"
+        "    --files=<n>\n"
+        "        Number of generated desktop files (default 5000)\n"
+        "    --seed=<n>\n"
+        "        Seed of the corpus generator (default 1)\n"
+        "    --translations=<percent>\n"
+        "        Share of translated files (default 50)\n"
+        "    --disabled=<percent>\n"
+        "        Share of files with NoDisplay=true (default 10)\n"
+        "    --escapes=<percent>\n"
+        "        Share of files with escape sequences (default 20)\n"
+        "    --only-show-in=<percent>\n"
+        "        Share of files with OnlyShowIn (default 20)\n"
+        "    --extra-groups=<percent>\n"
+        "        Share of files with [Desktop Action] groups (default 30)\n"
+        "    --corpus-dir=<dir>\n"
+        "        Write the corpus to dir and keep it there\n"
+        "    --iterations=<n>\n"
+        "        Run every benchmark n times and report the fastest run "
+        "(default 5)\n"
+        "    --baseline=<file>\n"
+        "        Compare results with a baseline saved in file\n"
+        "    --save-baseline\n"
+        "        Save results to the --baseline file instead of comparing "
+        "them\n"
+        "    --tolerance=<percent>\n"
+        "        Warn if a result differs from the baseline by more than this "
+        "(default 10)\n"
+        "    -h, --help\n"
+        "        Display this help message\n");
+}
+
+unsigned long parse_number(const char *arg, const char *flag,
+                           unsigned long max) {
+    char *endptr;
+    errno = 0;
+    unsigned long result = strtoul(arg, &endptr, 10);
+    if (!isdigit((unsigned char)*arg) || *endptr != '\0' || errno != 0 ||
+        result > max) {
+        fmt::print(stderr, "Invalid value supplied to {}!\n", flag);
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+void write_corpus(const std::string &directory,
+                  const std::vector<CorpusFile> &corpus) {
+    for (const CorpusFile &file : corpus) {
+        std::string path = directory + '/' + file.name;
+        FILE *f = fopen(path.c_str(), "w");
+        if (f == NULL)
+            PFATALE("fopen");
+        if (fwrite(file.contents.data(), 1, file.contents.size(), f) !=
+            file.contents.size())
+            PFATALE("fwrite");
+        if (fclose(f) != 0)
+            PFATALE("fclose");
+    }
+}
+
+void remove_corpus(const std::string &directory,
+                   const std::vector<CorpusFile> &corpus) {
+    for (const CorpusFile &file : corpus)
+        unlink((directory + '/' + file.name).c_str());
+    rmdir(directory.c_str());
+}
+
+Inputs collect_inputs(const std::vector<CorpusFile> &corpus) {
+    Inputs result;
+    for (const CorpusFile &file : corpus) {
+        for (const std::string &line : split(file.contents, '\n')) {
+            if (line.empty() || line[0] == '#' || line[0] == '[')
+                continue;
+            size_t equal_sign = line.find('=');
+            if (equal_sign == std::string::npos)
+                continue;
+            std::string key = line.substr(0, equal_sign);
+            std::string value = line.substr(equal_sign + 1);
+            size_t bracket = key.find('[');
+            if (bracket != std::string::npos) {
+                result.locales.push_back(
+                    key.substr(bracket + 1, key.size() - bracket - 2));
+                result.locale_bytes += result.locales.back().size();
+            }
+            if (key == "Categories" || key == "Keywords" ||
+                key == "OnlyShowIn" || key == "MimeType") {
+                result.list_bytes += value.size();
+                result.lists.emplace_back(std::move(key), std::move(value));
+            } else {
+                result.string_bytes += value.size();
+                result.strings.emplace_back(std::move(key), std::move(value));
+            }
+        }
+    }
+    return result;
+}
+
+// Run func iterations times and return the duration of the fastest run in
+// seconds.
+template <typename F> double measure(unsigned long iterations, F &&func) {
+    double best = 0;
+    for (unsigned long i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double> duration =
+            std::chrono::steady_clock::now() - start;
+        if (i == 0 || duration.count() < best)
+            best = duration.count();
+    }
+    return best;
+}
+
+Result make_result(std::string name, size_t files, size_t bytes,
+                   double seconds) {
+    return {std::move(name), files / seconds, bytes / seconds / 1e6};
+}
+
+void save_baseline(const std::string &path, const std::string &description,
+                   const std::vector<Result> &results) {
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == NULL)
+        PFATALE("fopen");
+    fmt::print(f, "# {}\n", description);
+    for (const Result &result : results)
+        fmt::print(f, "{} {:.1f} {:.3f}\n", result.name,
+                   result.files_per_second, result.mb_per_second);
+    if (fclose(f) != 0)
+        PFATALE("fclose");
+}
+
+void compare_with_baseline(const std::string &path,
+                          const std::string &description,
+                          const std::vector<Result> &results,
+                          double tolerance) {
+    std::ifstream stream(path);
+    if (!stream) {
+        SPDLOG_ERROR("Couldn't open baseline '{}'!", path);
+        exit(EXIT_FAILURE);
+    }
+    std::string line;
+    std::getline(stream, line);
+    if (line != "# " + description) {
+        SPDLOG_WARN("Baseline '{}' has been measured with a different corpus "
+                    "({}), results can't be compared.",
+                    path, std::string_view(line).substr(2));
+        return;
+    }
+    std::map<std::string, double> baseline;
+    while (std::getline(stream, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double files_per_second;
+        if (fields >> name >> files_per_second)
+            baseline[name] = files_per_second;
+    }
+
+    int drifted = 0;
+    for (const Result &result : results) {
+        auto iter = baseline.find(result.name);
+        if (iter == baseline.end()) {
+            SPDLOG_WARN("Benchmark '{}' isn't in the baseline.", result.name);
+            continue;
+        }
+        double change =
+            (result.files_per_second - iter->second) / iter->second * 100;
+        if (change < -tolerance || change > tolerance) {
+            SPDLOG_WARN("Benchmark '{}' is {:.1f}% {} than the baseline "
+                        "({:.1f} files/s, baseline {:.1f} files/s).",
+                        result.name, std::abs(change),
+                        (change < 0 ? "slower" : "faster"),
+                        result.files_per_second, iter->second);
+            ++drifted;
+        }
+    }
+    if (drifted == 0)
+        fmt::print("Results are within {}% of the baseline.\n", tolerance);
+}
+}; // namespace
+
+int main(int argc, char **argv) {
+    CorpusOptions options;
+    const char *corpus_dir = nullptr;
+    const char *baseline_path = nullptr;
+    bool save = false;
+    unsigned long iterations = 5;
+    double tolerance = 10;
+
+    while (true) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"files",         required_argument, 0, 'n'},
+            {"seed",          required_argument, 0, 's'},
+            {"translations",  required_argument, 0, 'T'},
+            {"disabled",      required_argument, 0, 'D'},
+            {"escapes",       required_argument, 0, 'E'},
+            {"only-show-in",  required_argument, 0, 'O'},
+            {"extra-groups",  required_argument, 0, 'G'},
+            {"corpus-dir",    required_argument, 0, 'c'},
+            {"iterations",    required_argument, 0, 'i'},
+            {"baseline",      required_argument, 0, 'b'},
+            {"save-baseline", no_argument,       0, 'S'},
+            {"tolerance",     required_argument, 0, 't'},
+            {"help",          no_argument,       0, 'h'},
+            {0,               0,                 0, 0  }
+        };
+
+        int c = getopt_long(argc, argv, "h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n':
+            options.files = parse_number(optarg, "--files", 10000000);
+            break;
+        case 's':
+            options.seed = parse_number(optarg, "--seed", -1);
+            break;
+        case 'T':
+            options.translations = parse_number(optarg, "--translations", 100);
+            break;
+        case 'D':
+            options.disabled = parse_number(optarg, "--disabled", 100);
+            break;
+        case 'E':
+            options.escapes = parse_number(optarg, "--escapes", 100);
+            break;
+        case 'O':
+            options.only_show_in = parse_number(optarg, "--only-show-in", 100);
+            break;
+        case 'G':
+            options.extra_groups = parse_number(optarg, "--extra-groups", 100);
+            break;
+        case 'c':
+            corpus_dir = optarg;
+            break;
+        case 'i':
+            iterations = parse_number(optarg, "--iterations", 1000000);
+            if (iterations == 0)
+                iterations = 1;
+            break;
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 'S':
+            save = true;
+            break;
+        case 't':
+            tolerance = parse_number(optarg, "--tolerance", 1000);
+            break;
+        case 'h':
+            print_usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            print_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (save && baseline_path == nullptr) {
+        fmt::print(stderr, "--save-baseline requires --baseline!\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<CorpusFile> corpus = generate_corpus(options);
+    size_t corpus_bytes = 0;
+    for (const CorpusFile &file : corpus)
+        corpus_bytes += file.contents.size();
+
+    std::string directory;
+    if (corpus_dir != nullptr)
+        directory = corpus_dir;
+    else {
+        char tmpdir[] = "/tmp/j4dd-bench-XXXXXX";
+        if (mkdtemp(tmpdir) == NULL)
+            PFATALE("mkdtemp");
+        directory = tmpdir;
+    }
+    write_corpus(directory, corpus);
+    OnExit cleanup = [&]() {
+        if (corpus_dir == nullptr)
+            remove_corpus(directory, corpus);
+    };
+
+    std::vector<std::string> paths;
+    paths.reserve(corpus.size());
+    for (const CorpusFile &file : corpus)
+        paths.push_back(directory + '/' + file.name);
+    Inputs inputs = collect_inputs(corpus);
+    // This locale matches four suffixes, which is the worst case.
+    LocaleSuffixes suffixes("de_DE@euro");
+    stringlist_t desktopenvs = {"GNOME"};
+
+    fmt::print("Corpus: {} ({:.2f} MB)\n", options.describe(),
+               corpus_bytes / 1e6);
+
+    std::vector<Result> results;
+    size_t disabled = 0, invalid = 0;
+    double seconds = measure(iterations, [&]() {
+        disabled = invalid = 0;
+        LineReader liner;
+        for (const std::string &path : paths) {
+            try {
+                Application app(path.c_str(), liner, suffixes, desktopenvs);
+                sink = sink + app.name.size();
+            } catch (const disabled_error &) {
+                ++disabled;
+            } catch (const std::runtime_error &) {
+                ++invalid;
+            }
+        }
+    });
+    results.push_back(
+        make_result("application", paths.size(), corpus_bytes, seconds));
+    fmt::print("Parsed {} files, {} disabled, {} invalid\n", paths.size(),
+               disabled, invalid);
+
+    seconds = measure(iterations, [&]() {
+        for (const std::string &locale : inputs.locales)
+            sink = sink + suffixes.match(locale);
+    });
+    results.push_back(make_result("locale_match", paths.size(),
+                                  inputs.locale_bytes, seconds));
+
+    seconds = measure(iterations, [&]() {
+        for (const auto &[key, value] : inputs.strings)
+            sink = sink +
+                   Application::expand(key.c_str(), value.c_str()).size();
+    });
+    results.push_back(
+        make_result("expand", paths.size(), inputs.string_bytes, seconds));
+
+    seconds = measure(iterations, [&]() {
+        for (const auto &[key, value] : inputs.lists)
+            sink = sink +
+                   Application::expandlist(key.c_str(), value.c_str()).size();
+    });
+    results.push_back(
+        make_result("expandlist", paths.size(), inputs.list_bytes, seconds));
+
+    fmt::print("{:<16}{:>16}{:>12}\n", "benchmark", "files/s", "MB/s");
+    for (const Result &result : results)
+        fmt::print("{:<16}{:>16.1f}{:>12.3f}\n", result.name,
+                   result.files_per_second, result.mb_per_second);
+
+    if (baseline_path != nullptr) {
+        if (save)
+            save_baseline(baseline_path, options.describe(), results);
+        else
+            compare_with_baseline(baseline_path, options.describe(), results,
+                                  tolerance);
+    }
+    return EXIT_SUCCESS;
+}
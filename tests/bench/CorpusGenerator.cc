@@ -0,0 +1,166 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "CorpusGenerator.hh"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <cstddef>
+
+namespace
+{
+// std::uniform_int_distribution isn't portable between standard libraries,
+// splitmix64 is used to get the same corpus everywhere.
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (this->state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Returns a number in [0, n).
+    unsigned below(unsigned n) {
+        return next() % n;
+    }
+
+    bool percent(unsigned share) {
+        return below(100) < share;
+    }
+
+private:
+    uint64_t state;
+};
+
+constexpr std::array<const char *, 24> locales = {
+    "ar", "bg", "ca", "cs", "da", "de", "de_DE", "el",
+    "en_GB", "es", "fi", "fr", "fr_CA", "hu", "it", "ja",
+    "ko", "nl", "pl", "pt_BR", "sr@latin", "ru", "sv", "zh_CN"};
+
+constexpr std::array<const char *, 8> desktops = {
+    "GNOME", "KDE", "XFCE", "LXQt", "MATE", "Cinnamon", "Budgie", "i3"};
+
+constexpr std::array<const char *, 10> categories = {
+    "Utility", "Development", "Graphics", "Network", "Office",
+    "AudioVideo", "System", "Settings", "Game", "Education"};
+
+constexpr std::array<const char *, 12> words = {
+    "editor", "viewer", "manager", "browser", "player", "terminal",
+    "tool", "client", "monitor", "studio", "reader", "converter"};
+
+void add_translations(std::string &out, const char *key,
+                      const std::string &value, Random &random) {
+    // Translated files are translated into most of the locales.
+    for (const char *locale : locales) {
+        if (random.percent(80))
+            out += fmt::format("{}[{}]={} ({})\n", key, locale, value, locale);
+    }
+}
+
+// Escape sequences which Application::expand() understands.
+std::string escape(const std::string &value, Random &random) {
+    std::string result;
+    for (char c : value) {
+        if (c == ' ' && random.percent(50))
+            result += "\\s";
+        else
+            result += c;
+    }
+    result += random.percent(50) ? "\\t(\\\\)" : "\\n";
+    return result;
+}
+
+std::string generate_file(unsigned index, const CorpusOptions &options,
+                          Random &random) {
+    std::string word = words[random.below(words.size())];
+    std::string name = fmt::format("Application {} {}", index, word);
+    std::string generic_name = fmt::format("Generic {}", word);
+    std::string comment =
+        fmt::format("A synthetic {} used to benchmark j4-dmenu-desktop", word);
+    std::string exec = fmt::format("app{} --{} %U", index, word);
+    bool escaped = random.percent(options.escapes);
+    if (escaped) {
+        name = escape(name, random);
+        exec = escape(exec, random);
+    }
+
+    std::string out = "# Generated by j4-dmenu-bench\n[Desktop Entry]\n"
+                      "Type=Application\nVersion=1.5\n";
+    out += "Name=" + name + '\n';
+    out += "GenericName=" + generic_name + '\n';
+    out += "Comment=" + comment + '\n';
+    if (random.percent(options.translations)) {
+        add_translations(out, "Name", name, random);
+        add_translations(out, "GenericName", generic_name, random);
+        add_translations(out, "Comment", comment, random);
+    }
+    out += "Exec=" + exec + '\n';
+    out += fmt::format("Icon=app{}\n", index);
+    out += random.percent(10) ? "Terminal=true\n" : "Terminal=false\n";
+
+    out += "Categories=";
+    for (unsigned i = 0, count = 1 + random.below(3); i < count; ++i)
+        out += fmt::format("{};", categories[random.below(categories.size())]);
+    out += "\nKeywords=";
+    for (unsigned i = 0, count = 2 + random.below(4); i < count; ++i)
+        out += fmt::format("{}{};", words[random.below(words.size())],
+                           (escaped && i == 0 ? "\\;alias" : ""));
+    out += '\n';
+
+    if (random.percent(options.only_show_in)) {
+        out += "OnlyShowIn=";
+        for (unsigned i = 0, count = 1 + random.below(3); i < count; ++i)
+            out += fmt::format("{};", desktops[random.below(desktops.size())]);
+        out += '\n';
+    }
+    if (random.percent(options.disabled))
+        out += "NoDisplay=true\n";
+
+    if (random.percent(options.extra_groups)) {
+        for (unsigned i = 0, count = 1 + random.below(3); i < count; ++i) {
+            out += fmt::format("\n[Desktop Action action{}]\n", i);
+            out += fmt::format("Name=Action {} of {}\n", i, name);
+            out += fmt::format("Exec=app{} --action={}\n", index, i);
+        }
+    }
+    return out;
+}
+}; // namespace
+
+std::string CorpusOptions::describe() const {
+    return fmt::format(
+        "files={} seed={} translations={} disabled={} escapes={} "
+        "only-show-in={} extra-groups={}",
+        this->files, this->seed, this->translations, this->disabled,
+        this->escapes, this->only_show_in, this->extra_groups);
+}
+
+std::vector<CorpusFile> generate_corpus(const CorpusOptions &options) {
+    Random random(options.seed);
+    std::vector<CorpusFile> result;
+    result.reserve(options.files);
+    for (unsigned i = 0; i < options.files; ++i) {
+        result.push_back({fmt::format("app-{:05}.desktop", i),
+                          generate_file(i, options, random)});
+    }
+    return result;
+}
@@ -0,0 +1,57 @@
+//
+// This file is part of j4-dmenu-desktop.
+//
+// j4-dmenu-desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// j4-dmenu-desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with j4-dmenu-desktop.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// This generates a deterministic corpus of synthetic desktop files for
+// j4-dmenu-bench. The same options always produce the same files.
+
+#ifndef CORPUSGENERATOR_DEF
+#define CORPUSGENERATOR_DEF
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct CorpusOptions
+{
+    unsigned files = 5000;
+    uint64_t seed = 1;
+    // These are percentages (0-100) of files which have the given feature.
+    // Translated files have Name, GenericName and Comment in many locales.
+    unsigned translations = 50;
+    // Disabled files have NoDisplay=true.
+    unsigned disabled = 10;
+    // Values of these files contain escape sequences.
+    unsigned escapes = 20;
+    // These files have OnlyShowIn with a random list of desktops.
+    unsigned only_show_in = 20;
+    // These files have [Desktop Action] groups after [Desktop Entry].
+    unsigned extra_groups = 30;
+
+    // This is used to check that a baseline has been measured with the same
+    // corpus.
+    std::string describe() const;
+};
+
+struct CorpusFile
+{
+    std::string name;
+    std::string contents;
+};
+
+std::vector<CorpusFile> generate_corpus(const CorpusOptions &options);
+
+#endif
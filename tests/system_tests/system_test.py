@@ -12,6 +12,7 @@ import pathlib
 import shlex
 import shutil
 import subprocess
+import time
 
 import pytest
 
@@ -363,3 +364,68 @@ def test_halding_of_file_field_codes(run_j4dd, tmp_path):
     finally:
         async_result.wait()
     assert fifo_message == "1\n"
+
+
+def test_menu_snapshot_history_update(j4dd_path, tmp_path):
+    """Test that the snapshot follows history changes made by one-shot runs.
+
+    One-shot runs which use the menu snapshot record their choice in the usage
+    log directly. The daemon must notice it without being triggered.
+    """
+    runtime_dir = tmp_path / "runtime"
+    runtime_dir.mkdir()
+    fifo = tmp_path / "fifo"
+    usage_log = tmp_path / "usage-log"
+    menu = tmp_path / "menu"
+    env = os.environ.copy()
+    env.update(
+        {
+            "XDG_DATA_HOME": str(test_files / "desktop-file-samples/rank-0"),
+            "XDG_DATA_DIRS": str(empty_dir),
+            "XDG_RUNTIME_DIR": str(runtime_dir),
+        }
+    )
+    common_args = ["--menu-snapshot", "--usage-log", str(usage_log)]
+
+    def run_one_shot(dmenu: str) -> list[str]:
+        result = subprocess.run(
+            [j4dd_path, *common_args, "--log-level", "INFO", "--dmenu", dmenu],
+            env=env,
+            capture_output=True,
+            text=True,
+            timeout=10,
+        )
+        assert result.returncode == 0, result.stderr
+        assert "Menu snapshot isn't available" not in result.stderr
+        return menu.read_text().splitlines()
+
+    daemon = subprocess.Popen(
+        [j4dd_path, *common_args, "--wait-on", str(fifo), "--dmenu", "true"],
+        env=env,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    try:
+        deadline = time.monotonic() + 10
+        while not list(runtime_dir.glob("*.snapshot")):
+            assert time.monotonic() < deadline, "The snapshot wasn't created"
+            time.sleep(0.05)
+        # Wait for the first publish.
+        time.sleep(0.5)
+
+        assert run_one_shot(f"cat > {shlex.quote(str(menu))}") == [
+            "Eagle",
+            "Rank 0 collision",
+        ]
+        run_one_shot(f"cat > {shlex.quote(str(menu))}; echo 'Rank 0 collision'")
+
+        deadline = time.monotonic() + 10
+        while True:
+            order = run_one_shot(f"cat > {shlex.quote(str(menu))}")
+            if order[0] == "Rank 0 collision":
+                break
+            assert time.monotonic() < deadline, f"The snapshot wasn't updated: {order}"
+            time.sleep(0.2)
+    finally:
+        daemon.terminate()
+        daemon.wait()